@@ -42,6 +42,7 @@ typedef struct _csSoundInfo
   float limit;
   float average;
   unsigned int format;
+  float rms;
 } csSoundInfo;
 
 typedef struct _csSoundQuickInfo
@@ -75,11 +76,21 @@ typedef struct _csSfxr {
   unsigned int (*size)(void *p, unsigned int method);
   void (*set_PCM)(void *p, unsigned int sample_rate, unsigned int bit_depth);
   void (*set_float)(void *p);
+  void (*set_mode)(void *p, unsigned int m);
+  unsigned int (*get_mode)(void *p);
   void (*get_info)(void *p, csSoundInfo* info);
   void (*get_infoq)(void *p, csSoundQuickInfo* info);
   int (*get_paramindex)(void *p, const char* pname);
   float (*get_param)(void *p, int index);
   void (*set_param)(void *p, int index, float f);
+  void (*begin_stream)(void *p);
+  unsigned int (*render_into)(void *p, float* dst, unsigned int n);
+  bool (*is_finished)(void *p);
+  unsigned int (*predict_length)(void *p, csParameters* x);
+  bool (*load_buffer)(void *p, const void* data, unsigned int size, bool copy);
+  bool (*write_buffer)(void *p, void* data, unsigned int size);
+  size_t (*create_batch)(void *p, int what, const unsigned long long* seeds, unsigned int count, unsigned int method, void* out, size_t* offsets, unsigned int threads);
+  void (*seed_keyed)(void *p, unsigned long long s, unsigned long long index, unsigned int purpose);
 } csSfxr;
 
 void cs_get(struct _csSfxr* p);
@@ -331,6 +342,7 @@ function Sfxr:getInfo()
   ret.overhead = self.fi.overhead;
   ret.limit = self.fi.limit;
   ret.average = self.fi.average;
+  ret.rms = self.fi.rms;
   return ret;
 end
 
@@ -5,6 +5,9 @@ rm *.wav
 rm *.lib
 rm *.a
 rm *.raw
+rm *.sfxb
+rm *.sf
+rm -r ./snd_cache
 rm ./dll/*.o
 rm ./dll/*.dylib
 rm ./dll/*.so
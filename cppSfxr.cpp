@@ -23,6 +23,23 @@
 		* supports modes: normalize (to normalize output) and word (to force fixed point 16-bit param data)
 		* you can attach data to a sound definition, and that binary block is written/read with the definition when serialized
 		* if you attach data in word mode, it can't exceed 65,464 bytes because the size param is written uint16_t
+		* the synth loop is specialized per wave type and active stages (lpf, phaser, vibrato), picked once per sound
+		* SfxrBatch renders many sounds at once, one lane per sound, with the same output as Sfxr::create()
+		* mode SFXR_FAST_MATH swaps sin/tan/pow in the synth for polynomials, close to but not bit exact with the reference
+		* output is kept in one contiguous aligned buffer, reserved from the envelope length before synthesis
+		* that buffer's memory comes from a per thread pool, so instances made and dropped in a loop reuse it
+		* mode SFXR_DIRECT_PCM only measures on create(), PCM8/PCM16 exportBuffer() synths straight into the destination
+		* peak, average and rms are gathered while synthing, and SFXR_NORMALIZE is applied as exports convert the samples
+		* PCM conversion is vectorized (SSE2/AVX2/NEON) and saturating, mode SFXR_DITHER adds TPDF dither to PCM8/PCM16
+		* predictLength() and predictSize() give the exact length of a sound from its parameters, without synthing it
+		* setVolume()/getVolume() for the sound_vol kept in SF/SW streams (and libSfxr sound banks)
+		* getSampleRate()/getBitDepth(), so libSfxr's render cache can key an export on everything that shapes it
+		* loadBuffer()/writeBuffer() parse SF/SW records straight from memory, loadString() no longer rejects them
+		* createBatch() makes many seeded variants of a kind in one call, packed with an offset table, over threads if asked
+		* seed(s, index, purpose) keys PCG32 streams so generation is the same on any thread, pink noise restarts each render
+		* white and pink noise come from tables made once and shared by every render, a refill is a step to the next block
+		* the synth loop finds the next repeat, arpeggio or envelope event and runs the samples up to it without checks
+		* mode SFXR_CONTROL_RATE works the vibrato, filter sweeps and envelope out every SFXR_CONTROL_SAMPLES, lines between
 */
 
 #define _USE_MATH_DEFINES
@@ -38,6 +55,22 @@
 #include <fstream>
 #include <vector>
 #include <array>
+#include <algorithm>
+#include <new>
+#include <cfloat>
+#include <thread>
+#include <atomic>
+// PCM conversion is vectorized for what the build targets, see SfxrQuantizer
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SFXR_QUANT_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SFXR_QUANT_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define SFXR_QUANT_NEON
+#endif
 
 using namespace std;
 
@@ -87,31 +120,146 @@ typedef struct WaveFloatFileHeader {
 #define PV(x) paramData.x
 
 // *************************************************************************************
-// simple collection of 16kb float buffers for data
+#define SFXR_BUFFER_ALIGN	64		// bytes, a cache line and a full AVX-512 register
+#define SFXR_BUFFER_CHUNK	4096	// samples, least growth and the size of stream conversion pieces
+
+// free sample runs kept for reuse by every buffer on a thread, up to a high-water mark of bytes held
+class SfxrSamplePool {
+public:
+	struct Run { float* data; unsigned int count; };
+	vector<Run> runs;
+	size_t held = 0;
+	size_t limit = SFXR_POOL_LIMIT;
+
+	~SfxrSamplePool() { trim(0); }
+
+	float* take(unsigned int& count);			// a run of at least count samples, pooled or new
+	void give(float* data, unsigned int count);	// back into the pool, or freed if over the limit
+	void trim(size_t keep);						// free runs until no more than keep bytes are held
+
+	static SfxrSamplePool* local();				// this thread's pool, nullptr once the thread is tearing down
+};
+
+static thread_local SfxrSamplePool* tlsSamplePool = nullptr;
+static thread_local bool tlsSamplePoolDone = false;
+
+// owns the thread's pool, pointer and flag stay trivially destructible so late frees still see them
+struct SfxrSamplePoolOwner {
+	~SfxrSamplePoolOwner()
+	{
+		delete tlsSamplePool;
+		tlsSamplePool = nullptr;
+		tlsSamplePoolDone = true;
+	}
+};
+static thread_local SfxrSamplePoolOwner tlsSamplePoolOwner;
+
+SfxrSamplePool* SfxrSamplePool::local()
+{
+	if (tlsSamplePool == nullptr && !tlsSamplePoolDone)
+	{
+		(void)&tlsSamplePoolOwner;	// odr-use, so the owner is constructed (and later destroyed) on this thread
+		tlsSamplePool = new SfxrSamplePool();
+	}
+	return tlsSamplePool;
+}
+
+static float* sfxrAllocSamples(unsigned int count)
+{
+	return (float*)::operator new(sizeof(float) * (size_t)count, align_val_t(SFXR_BUFFER_ALIGN));
+}
+
+static void sfxrFreeSamples(float* data)
+{
+	::operator delete(data, align_val_t(SFXR_BUFFER_ALIGN));
+}
+
+float* SfxrSamplePool::take(unsigned int& count)
+{
+	// best fit, but no more than twice the size asked for, count comes back as the size of the run
+	size_t best = runs.size();
+	for (size_t i = 0; i < runs.size(); i++)
+	{
+		if (runs[i].count < count || runs[i].count > count * 2) continue;
+		if (best == runs.size() || runs[i].count < runs[best].count) best = i;
+	}
+	if (best == runs.size())
+		return sfxrAllocSamples(count);
+	float* data = runs[best].data;
+	count = runs[best].count;
+	held -= sizeof(float) * (size_t)count;
+	runs[best] = runs.back();
+	runs.pop_back();
+	return data;
+}
+
+void SfxrSamplePool::give(float* data, unsigned int count)
+{
+	if (data == nullptr) return;
+	size_t bytes = sizeof(float) * (size_t)count;
+	if (held + bytes > limit)
+	{
+		sfxrFreeSamples(data);
+		return;
+	}
+	runs.push_back({ data, count });
+	held += bytes;
+}
+
+void SfxrSamplePool::trim(size_t keep)
+{
+	// largest first, gives the most back for the fewest frees
+	while (held > keep && !runs.empty())
+	{
+		size_t big = 0;
+		for (size_t i = 1; i < runs.size(); i++)
+			if (runs[i].count > runs[big].count) big = i;
+		sfxrFreeSamples(runs[big].data);
+		held -= sizeof(float) * (size_t)runs[big].count;
+		runs[big] = runs.back();
+		runs.pop_back();
+	}
+}
+
+// one contiguous, aligned run of float samples, sized up front from the envelope and grown only if needed
+struct SfxrDither;
+
 class SfxrFloatBuffer {
 public:
-	vector<array<float, 4096>*> bTable;
-	array<float, 4096>* pBlock;
-	unsigned int pos;
+	float* data;
+	unsigned int pos;		// samples written
+	unsigned int capacity;	// samples allocated
+	// running statistics of what's been written, gathered by the synth as it goes
+	float peak;
+	double sumAbs;
+	double sumSquares;
 
 #ifdef SFXR_STATIC_STREAM_BUFFER
-	char staticBuffer[4096 * 4];
+	char staticBuffer[SFXR_BUFFER_CHUNK * 4];
 #endif
 
 	SfxrFloatBuffer();
+	~SfxrFloatBuffer();
 
 	unsigned int size();
 	unsigned int sizeBytes();
 	unsigned int memoryBytes();
 	void getLimitAverage(float* l, float* a);
-	void scale(float x);
+	float getRMS();
+	float bound();	// largest |sample|, infinite if a NaN got in
 	void clear();
+	void reserve(unsigned int count);	// room for count samples in total, keeps what was written
+
+	// gain is applied as the samples are converted (SFXR_NORMALIZE), 1.0f leaves them exact
+	void writeStream(ostream& ofx, float gain = 1.0f);		// float streams
+	void writeStream8(ostream& ofx, float gain = 1.0f, SfxrDither* dither = nullptr);	// UINT8 PCM streams
+	void writeStream16(ostream& ofx, float gain = 1.0f, SfxrDither* dither = nullptr);	// INT16 PCM streams
+	void writeStream24(ostream& ofx, float gain = 1.0f);	// INT24 PCM streams
+	void writeStream32(ostream& ofx, float gain = 1.0f);	// INT32 PCM streams
 
-	void writeStream(ostream& ofx);		// float streams
-	void writeStream8(ostream& ofx);	// UINT8 PCM streams
-	void writeStream16(ostream& ofx);	// INT16 PCM streams
-	void writeStream24(ostream& ofx);	// INT24 PCM streams
-	void writeStream32(ostream& ofx);	// INT32 PCM streams
+	float* writeBlock(unsigned int& room);	// where the next samples go, and how many fit
+	void commit(unsigned int count, float blockPeak, double blockAbs, double blockSquares);
+											// count samples were written at writeBlock(), with their statistics
 
 	void operator<<(float f);
 	float operator[](unsigned int index);
@@ -120,8 +268,11 @@ public:
 SfxrFloatBuffer::SfxrFloatBuffer()
 {
 	pos = 0;
-	pBlock = new array<float, 4096>;
-	bTable.reserve(128);
+	capacity = 0;
+	data = nullptr;
+	peak = 0.0f;
+	sumAbs = sumSquares = 0.0;
+	reserve(SFXR_BUFFER_CHUNK);
 #ifdef SFXR_STATIC_STREAM_BUFFER
 #pragma omp simd
 	for (int i = 0; i < 16384; i++)
@@ -129,184 +280,490 @@ SfxrFloatBuffer::SfxrFloatBuffer()
 #endif
 }
 
+SfxrFloatBuffer::~SfxrFloatBuffer()
+{
+	SfxrSamplePool* pool = SfxrSamplePool::local();
+	if (pool != nullptr) pool->give(data, capacity);
+	else sfxrFreeSamples(data);
+}
+
 unsigned int SfxrFloatBuffer::size()
 {
-	return (unsigned int)bTable.size() * 4096 + pos;
+	return pos;
 }
 
 unsigned int SfxrFloatBuffer::sizeBytes()
 {
-	return (unsigned int)(bTable.size() * 4096 + pos) * sizeof(float);
+	return pos * (unsigned int)sizeof(float);
 }
 
 unsigned int SfxrFloatBuffer::memoryBytes()
 {
-	return (unsigned int)((bTable.size()+1) * sizeof(array<float, 4096>));
+	return capacity * (unsigned int)sizeof(float);
+}
+
+void SfxrFloatBuffer::reserve(unsigned int count)
+{
+	// round up to whole chunks, so a sound a little past its estimate doesn't copy twice
+	count = (count + SFXR_BUFFER_CHUNK - 1) / SFXR_BUFFER_CHUNK * SFXR_BUFFER_CHUNK;
+	// an empty buffer far bigger than asked for (left from a long sound) is given back
+	if (count <= capacity && (pos > 0 || capacity / 4 <= count)) return;
+	SfxrSamplePool* pool = SfxrSamplePool::local();
+	float* grown = pool != nullptr ? pool->take(count) : sfxrAllocSamples(count);
+	if (pos > 0) memcpy(grown, data, sizeof(float) * (size_t)pos);
+	if (pool != nullptr) pool->give(data, capacity);
+	else sfxrFreeSamples(data);
+	data = grown;
+	capacity = count;
 }
 
 void SfxrFloatBuffer::getLimitAverage(float* l, float* a)
 {
-	float limit = 0.0f;
-	double average = 0.0f;
-	double count = 0.0f;
-	for (const auto& block : bTable)
+	*l = peak;
+	*a = pos > 0 ? (float(sumAbs / (double)pos)) : 0.0f;
+}
+
+float SfxrFloatBuffer::getRMS()
+{
+	return pos > 0 ? (float)sqrt(sumSquares / (double)pos) : 0.0f;
+}
+
+float SfxrFloatBuffer::bound()
+{
+	// a NaN never wins the peak compare, but it does poison the sum of squares
+	return isfinite(sumSquares) ? peak : INFINITY;
+}
+
+void SfxrFloatBuffer::operator<<(float f)
+{
+	if (pos == capacity) reserve(capacity + max(capacity / 2, (unsigned int)SFXR_BUFFER_CHUNK));
+	float level = fabs(f);
+	peak = level > peak ? level : peak;
+	sumAbs += (double)level;
+	sumSquares += (double)level * (double)level;
+	data[pos++] = f;
+}
+
+float* SfxrFloatBuffer::writeBlock(unsigned int& room)
+{
+	// only grows once the reserved space is used up, by half again so a long sound copies a few times at most
+	if (pos == capacity) reserve(capacity + max(capacity / 2, (unsigned int)SFXR_BUFFER_CHUNK));
+	room = capacity - pos;
+	return data + pos;
+}
+
+void SfxrFloatBuffer::commit(unsigned int count, float blockPeak, double blockAbs, double blockSquares)
+{
+	pos += count;
+	peak = blockPeak > peak ? blockPeak : peak;
+	sumAbs += blockAbs;
+	sumSquares += blockSquares;
+}
+
+void SfxrFloatBuffer::writeStream(ostream& ofx, float gain)
+{
+	if (gain == 1.0f)
 	{
-		for (const auto& sample : *block)
+		ofx.write((const char*)data, sizeof(float) * pos);
+		return;
+	}
+#ifndef SFXR_STATIC_STREAM_BUFFER
+	float* buffer = new float[SFXR_BUFFER_CHUNK];
+#else
+	float* buffer = (float*)staticBuffer;
+#endif
+	for (unsigned int at = 0; at < pos; at += SFXR_BUFFER_CHUNK)
+	{
+		unsigned int n = min(pos - at, (unsigned int)SFXR_BUFFER_CHUNK);
+		const float* src = data + at;
+#pragma omp simd
+		for (unsigned int i = 0; i < n; i++)
+			buffer[i] = src[i] * gain;
+		ofx.write((const char*)buffer, sizeof(float) * n);
+	}
+#ifndef SFXR_STATIC_STREAM_BUFFER
+	delete[] buffer;
+#endif
+}
+
+// float to PCM conversion, shared by the stream writers and the direct (SFXR_DIRECT_PCM) export so both give the same bytes.
+// every format goes the same way: scale by gain (SFXR_NORMALIZE) times the format's full scale, NaN to 0 (a negative
+// sample compressed by pow()), clamp, then truncate like the plain casts always did, or with SFXR_DITHER add TPDF dither
+// and round to nearest. bound is the largest |sample| the caller knows of (the synth keeps it as it goes); when it is
+// finite and can't reach full scale the NaN check and clamp are skipped, which is most of the cost. picked at compile
+// time like SfxrBatch: AVX2 with -mavx2, else SSE2 on x86-64, NEON on 64-bit ARM, or plain C, 8 samples a step packed
+// straight into the destination.
+
+// TPDF dither source, xorshift32 per lane, seeded the same for every export so output is still repeatable
+struct SfxrDither {
+	uint32_t state[8];
+
+	SfxrDither()
+	{
+		for (int k = 0; k < 8; k++)
+			state[k] = 0x9E3779B9u * (uint32_t)(k + 1) ^ 0x53667872u;
+	}
+
+	// one triangular value in (-1, 1) LSB, from lane 0
+	float next()
+	{
+		return uniform() - uniform();
+	}
+
+	float uniform()
+	{
+		uint32_t s = state[0];
+		s ^= s << 13;
+		s ^= s >> 17;
+		s ^= s << 5;
+		state[0] = s;
+		return (float)(s >> 8) * (1.0f / 16777216.0f);
+	}
+};
+
+// 8 samples at a time to int32, run() leaves them in two halves of 4
+class SfxrQuantizer {
+public:
+	float scale, limit;
+	bool clamp;
+	SfxrDither* dither;
+#if defined(SFXR_QUANT_AVX2)
+	__m256 s, hi, lo, unit;
+	__m256i st;
+
+	SfxrQuantizer(float gain, float full, float bound, SfxrDither* _dither) : dither(_dither)
+	{
+		setup(gain, full, bound);
+		s = _mm256_set1_ps(scale);
+		hi = _mm256_set1_ps(limit);
+		lo = _mm256_set1_ps(-limit);
+		unit = _mm256_set1_ps(1.0f / 16777216.0f);
+		st = dither != nullptr ? _mm256_loadu_si256((const __m256i*)dither->state) : _mm256_setzero_si256();
+	}
+	void sync() { if (dither != nullptr) _mm256_storeu_si256((__m256i*)dither->state, st); }
+
+	__m256 uniform()
+	{
+		st = _mm256_xor_si256(st, _mm256_slli_epi32(st, 13));
+		st = _mm256_xor_si256(st, _mm256_srli_epi32(st, 17));
+		st = _mm256_xor_si256(st, _mm256_slli_epi32(st, 5));
+		return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(st, 8)), unit);
+	}
+
+	template<bool CLAMP, bool DITHER>
+	inline void run(const float* src, __m128i& a, __m128i& b)
+	{
+		__m256 v = _mm256_mul_ps(_mm256_loadu_ps(src), s);
+		if constexpr (CLAMP) v = _mm256_and_ps(v, _mm256_cmp_ps(v, v, _CMP_ORD_Q));
+		if constexpr (DITHER)
 		{
-			float a = fabs(sample);
-			average += (double)a;
-			if (a > limit) limit = a;
-			count += 1.0;
+			__m256 d = uniform();
+			v = _mm256_add_ps(v, _mm256_sub_ps(d, uniform()));
 		}
+		if constexpr (CLAMP) v = _mm256_min_ps(_mm256_max_ps(v, lo), hi);
+		__m256i r = DITHER ? _mm256_cvtps_epi32(v) : _mm256_cvttps_epi32(v);
+		a = _mm256_castsi256_si128(r);
+		b = _mm256_extracti128_si256(r, 1);
 	}
-	for (const auto& sample : *pBlock)
+#elif defined(SFXR_QUANT_SSE2)
+	__m128 s, hi, lo, unit;
+	__m128i st;
+
+	SfxrQuantizer(float gain, float full, float bound, SfxrDither* _dither) : dither(_dither)
 	{
-		float a = fabs(sample);
-		average += (double)a;
-		if (a > limit) limit = a;
-		count += 1.0;
+		setup(gain, full, bound);
+		s = _mm_set1_ps(scale);
+		hi = _mm_set1_ps(limit);
+		lo = _mm_set1_ps(-limit);
+		unit = _mm_set1_ps(1.0f / 16777216.0f);
+		st = dither != nullptr ? _mm_loadu_si128((const __m128i*)dither->state) : _mm_setzero_si128();
 	}
-	*l = limit;
-	*a = (float(average / count));
-}
+	void sync() { if (dither != nullptr) _mm_storeu_si128((__m128i*)dither->state, st); }
+
+	__m128 uniform()
+	{
+		st = _mm_xor_si128(st, _mm_slli_epi32(st, 13));
+		st = _mm_xor_si128(st, _mm_srli_epi32(st, 17));
+		st = _mm_xor_si128(st, _mm_slli_epi32(st, 5));
+		return _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(st, 8)), unit);
+	}
+
+	template<bool CLAMP, bool DITHER>
+	inline __m128i run4(const float* src)
+	{
+		__m128 v = _mm_mul_ps(_mm_loadu_ps(src), s);
+		if constexpr (CLAMP) v = _mm_and_ps(v, _mm_cmpord_ps(v, v));
+		if constexpr (DITHER)
+		{
+			__m128 d = uniform();
+			v = _mm_add_ps(v, _mm_sub_ps(d, uniform()));
+		}
+		if constexpr (CLAMP) v = _mm_min_ps(_mm_max_ps(v, lo), hi);
+		return DITHER ? _mm_cvtps_epi32(v) : _mm_cvttps_epi32(v);
+	}
+
+	template<bool CLAMP, bool DITHER>
+	inline void run(const float* src, __m128i& a, __m128i& b)
+	{
+		a = run4<CLAMP, DITHER>(src);
+		b = run4<CLAMP, DITHER>(src + 4);
+	}
+#elif defined(SFXR_QUANT_NEON)
+	float32x4_t s, hi, lo;
+	uint32x4_t st;
 
-void SfxrFloatBuffer::scale(float x)
+	SfxrQuantizer(float gain, float full, float bound, SfxrDither* _dither) : dither(_dither)
+	{
+		setup(gain, full, bound);
+		s = vdupq_n_f32(scale);
+		hi = vdupq_n_f32(limit);
+		lo = vdupq_n_f32(-limit);
+		st = dither != nullptr ? vld1q_u32(dither->state) : vdupq_n_u32(0);
+	}
+	void sync() { if (dither != nullptr) vst1q_u32(dither->state, st); }
+
+	float32x4_t uniform()
+	{
+		st = veorq_u32(st, vshlq_n_u32(st, 13));
+		st = veorq_u32(st, vshrq_n_u32(st, 17));
+		st = veorq_u32(st, vshlq_n_u32(st, 5));
+		return vmulq_n_f32(vcvtq_f32_u32(vshrq_n_u32(st, 8)), 1.0f / 16777216.0f);
+	}
+
+	template<bool CLAMP, bool DITHER>
+	inline int32x4_t run4(const float* src)
+	{
+		float32x4_t v = vmulq_f32(vld1q_f32(src), s);
+		if constexpr (CLAMP) v = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(v), vceqq_f32(v, v)));
+		if constexpr (DITHER)
+		{
+			float32x4_t d = uniform();
+			v = vaddq_f32(v, vsubq_f32(d, uniform()));
+		}
+		if constexpr (CLAMP) v = vminq_f32(vmaxq_f32(v, lo), hi);
+		return DITHER ? vcvtnq_s32_f32(v) : vcvtq_s32_f32(v);
+	}
+
+	template<bool CLAMP, bool DITHER>
+	inline void run(const float* src, int32x4_t& a, int32x4_t& b)
+	{
+		a = run4<CLAMP, DITHER>(src);
+		b = run4<CLAMP, DITHER>(src + 4);
+	}
+#else
+	SfxrQuantizer(float gain, float full, float bound, SfxrDither* _dither) : dither(_dither)
+	{
+		setup(gain, full, bound);
+	}
+	void sync() {}
+#endif
+
+	void setup(float gain, float full, float bound)
+	{
+		scale = gain * full;
+		// 32-bit full scale isn't a float, stay under the largest one that converts
+		limit = full < 2147483520.0f ? full : 2147483520.0f;
+		// rounding keeps order, so no sample lands past bound * scale; dither can add up to 1, and a NaN bound fails
+		clamp = !(bound * scale + (dither != nullptr ? 1.0f : 0.0f) <= limit);
+	}
+
+	// the same for one sample, for the tails and plain C builds
+	inline int32_t one(float x)
+	{
+		float v = x * scale;
+		if (v != v) v = 0.0f;
+		if (dither != nullptr) v += dither->next();
+		if (clamp)
+		{
+			v = v > limit ? limit : v;
+			v = v < -limit ? -limit : v;
+		}
+		return dither != nullptr ? (int32_t)lrintf(v) : (int32_t)v;
+	}
+};
+
+#if defined(SFXR_QUANT_AVX2) || defined(SFXR_QUANT_SSE2)
+#define SFXR_QUANT_X86
+#endif
+
+// the vector part of a conversion, 8 samples a step, returns how far it got for the scalar tail to finish
+template<int BITS, bool CLAMP, bool DITHER>
+static unsigned int sfxrPackRun(SfxrQuantizer& q, const float* src, void* out, unsigned int n)
 {
-	for (const auto& block : bTable)
+	unsigned int i = 0;
+	// a 24-bit step writes one byte past its samples, so it leaves at least one to the tail
+	unsigned int end = BITS == 24 ? (n > 0 ? n - 1 : 0) : n;
+#if defined(SFXR_QUANT_X86)
+	for (; i + 8 <= end; i += 8)
+	{
+		__m128i a, b;
+		q.run<CLAMP, DITHER>(src + i, a, b);
+		if constexpr (BITS == 8)
+		{
+			const __m128i mid = _mm_set1_epi32(0x7F);
+			__m128i w = _mm_packs_epi32(_mm_add_epi32(a, mid), _mm_add_epi32(b, mid));
+			_mm_storel_epi64((__m128i*)((uint8_t*)out + i), _mm_packus_epi16(w, w));
+		}
+		else if constexpr (BITS == 16)
+			_mm_storeu_si128((__m128i*)((int16_t*)out + i), _mm_packs_epi32(a, b));
+		else if constexpr (BITS == 24)
+		{
+			int32_t w[8];
+			_mm_storeu_si128((__m128i*)w, a);
+			_mm_storeu_si128((__m128i*)(w + 4), b);
+			for (int k = 0; k < 8; k++)
+				memcpy((uint8_t*)out + (size_t)(i + k) * 3, &w[k], 4);
+		}
+		else
+		{
+			_mm_storeu_si128((__m128i*)((int32_t*)out + i), a);
+			_mm_storeu_si128((__m128i*)((int32_t*)out + i + 4), b);
+		}
+	}
+#elif defined(SFXR_QUANT_NEON)
+	for (; i + 8 <= end; i += 8)
 	{
-		for (int i = 0; i < 4096; i++)
-			(*block)[i] *= x;
+		int32x4_t a, b;
+		q.run<CLAMP, DITHER>(src + i, a, b);
+		if constexpr (BITS == 8)
+		{
+			const int32x4_t mid = vdupq_n_s32(0x7F);
+			int16x8_t w = vcombine_s16(vqmovn_s32(vaddq_s32(a, mid)), vqmovn_s32(vaddq_s32(b, mid)));
+			vst1_u8((uint8_t*)out + i, vqmovun_s16(w));
+		}
+		else if constexpr (BITS == 16)
+			vst1q_s16((int16_t*)out + i, vcombine_s16(vqmovn_s32(a), vqmovn_s32(b)));
+		else if constexpr (BITS == 24)
+		{
+			int32_t w[8];
+			vst1q_s32(w, a);
+			vst1q_s32(w + 4, b);
+			for (int k = 0; k < 8; k++)
+				memcpy((uint8_t*)out + (size_t)(i + k) * 3, &w[k], 4);
+		}
+		else
+		{
+			vst1q_s32((int32_t*)out + i, a);
+			vst1q_s32((int32_t*)out + i + 4, b);
+		}
 	}
-	for (int i = 0; i < pBlock->size(); i++)
-		(*pBlock)[i] *= x;
+#endif
+	return i;
 }
 
-void SfxrFloatBuffer::operator<<(float f)
+// pick the loop for the quantizer's setup once, not per sample. the dither state goes back before the scalar tail, which
+// carries on from lane 0 of it and is then what's left for the next chunk
+template<int BITS>
+static unsigned int sfxrPack(SfxrQuantizer& q, const float* src, void* out, unsigned int n)
 {
-	(*pBlock)[pos++] = f;
-	if (pos == 4096)
+	if (q.dither != nullptr)
 	{
-		pos = 0;
-		bTable.push_back(pBlock);
-		pBlock = new array<float, 4096>;
+		unsigned int i = q.clamp ? sfxrPackRun<BITS, true, true>(q, src, out, n) : sfxrPackRun<BITS, false, true>(q, src, out, n);
+		q.sync();
+		return i;
 	}
+	return q.clamp ? sfxrPackRun<BITS, true, false>(q, src, out, n) : sfxrPackRun<BITS, false, false>(q, src, out, n);
+}
+
+static void sfxrToPCM8(const float* src, uint8_t* dst, unsigned int n, float gain = 1.0f, SfxrDither* dither = nullptr, float bound = INFINITY)
+{
+	SfxrQuantizer q(gain, (float)0x7F, bound, dither);
+	for (unsigned int i = sfxrPack<8>(q, src, dst, n); i < n; i++)
+		dst[i] = (uint8_t)(q.one(src[i]) + 0x7F);
+}
+
+static void sfxrToPCM16(const float* src, int16_t* dst, unsigned int n, float gain = 1.0f, SfxrDither* dither = nullptr, float bound = INFINITY)
+{
+	SfxrQuantizer q(gain, (float)0x7FFE, bound, dither);
+	for (unsigned int i = sfxrPack<16>(q, src, dst, n); i < n; i++)
+		dst[i] = (int16_t)q.one(src[i]);
 }
 
-void SfxrFloatBuffer::writeStream(ostream& ofx)
+// little endian 3 byte samples: each one is a 4 byte store the next one overwrites the top of, the last one done by hand
+static void sfxrToPCM24(const float* src, uint8_t* dst, unsigned int n, float gain = 1.0f, float bound = INFINITY)
 {
-	for (const auto& block : bTable)
+	SfxrQuantizer q(gain, (float)0x7FFFFE, bound, nullptr);
+	for (unsigned int i = sfxrPack<24>(q, src, dst, n); i < n; i++)
 	{
-		ofx.write((const char*)block->data(), sizeof(float) * 4096);
+		int32_t w = q.one(src[i]);
+		memcpy(dst + (size_t)i * 3, &w, 3);
 	}
-	ofx.write((const char*)pBlock->data(), sizeof(float) * pos);
 }
 
-void SfxrFloatBuffer::writeStream8(ostream& ofx)
+static void sfxrToPCM32(const float* src, int32_t* dst, unsigned int n, float gain = 1.0f, float bound = INFINITY)
+{
+	SfxrQuantizer q(gain, (float)0x7FFFFFFE, bound, nullptr);
+	for (unsigned int i = sfxrPack<32>(q, src, dst, n); i < n; i++)
+		dst[i] = q.one(src[i]);
+}
+
+void SfxrFloatBuffer::writeStream8(ostream& ofx, float gain, SfxrDither* dither)
 {
 #ifndef SFXR_STATIC_STREAM_BUFFER
-	int8_t* buffer = new int8_t[4096];
+	uint8_t* buffer = new uint8_t[SFXR_BUFFER_CHUNK];
 #else
 	uint8_t* buffer = (uint8_t*)staticBuffer;
 #endif
-	for (const auto& block : bTable)
+	for (unsigned int at = 0; at < pos; at += SFXR_BUFFER_CHUNK)
 	{
-#pragma omp simd
-		for (int i = 0; i < 4096; i++)
-		{
-			uint8_t debug = (int8_t)((*block)[i] * (float)0x7F) + 0x7F;
-			buffer[i] = debug;
-		}
-		ofx.write((const char*)buffer, 4096);
+		unsigned int n = min(pos - at, (unsigned int)SFXR_BUFFER_CHUNK);
+		sfxrToPCM8(data + at, buffer, n, gain, dither, bound());
+		ofx.write((const char*)buffer, n);
 	}
-	for (int i = 0; i < 4096; i++)
-	{
-		uint8_t debug = (int8_t)((*pBlock)[i] * (float)0x7F) + 0x7F;
-		buffer[i] = debug;
-	}
-	ofx.write((const char*)buffer, pos);
 #ifndef SFXR_STATIC_STREAM_BUFFER
 	delete[] buffer;
 #endif
 }
 
-void SfxrFloatBuffer::writeStream16(ostream& ofx)
+void SfxrFloatBuffer::writeStream16(ostream& ofx, float gain, SfxrDither* dither)
 {
 #ifndef SFXR_STATIC_STREAM_BUFFER
-	int16_t* buffer = new int16_t[4096];
+	int16_t* buffer = new int16_t[SFXR_BUFFER_CHUNK];
 #else
 	int16_t* buffer = (int16_t*)staticBuffer;
 #endif
-	for (const auto& block : bTable)
+	for (unsigned int at = 0; at < pos; at += SFXR_BUFFER_CHUNK)
 	{
-#pragma omp simd
-		for (int i = 0; i < 4096; i++)
-		{
-			buffer[i] = (int16_t)((*block)[i] * (float)0x7FFE);
-		}
-		ofx.write((const char*)buffer, 4096 * 2);
+		unsigned int n = min(pos - at, (unsigned int)SFXR_BUFFER_CHUNK);
+		sfxrToPCM16(data + at, buffer, n, gain, dither, bound());
+		ofx.write((const char*)buffer, (size_t)n * 2);
 	}
-	for (unsigned int i = 0; i < pos; i++)
-		buffer[i] = (int16_t)((*pBlock)[i] * (float)0x7FFE);
-	ofx.write((const char*)buffer, (size_t)pos * 2);
 #ifndef SFXR_STATIC_STREAM_BUFFER
 	delete[] buffer;
 #endif
 }
 
-void SfxrFloatBuffer::writeStream24(ostream& ofx)
+void SfxrFloatBuffer::writeStream24(ostream& ofx, float gain)
 {
 #ifndef SFXR_STATIC_STREAM_BUFFER
-	int8_t* buffer = new int8_t[4096];
+	uint8_t* buffer = new uint8_t[SFXR_BUFFER_CHUNK * 3];
 #else
 	uint8_t* buffer = (uint8_t*)staticBuffer;
 #endif
-	unsigned int bpos = 0;
-	for (const auto& block : bTable)
+	for (unsigned int at = 0; at < pos; at += SFXR_BUFFER_CHUNK)
 	{
-		bpos = 0;
-#pragma omp simd
-		for (int i = 0; i < 4096; i++)
-		{
-			uint32_t debug = (int32_t)((*block)[i] * (float)0x7FFFFE);
-			buffer[bpos++] = debug & 0xFF;
-			buffer[bpos++] = (debug & 0xFF00) >> 8;
-			buffer[bpos++] = (debug & 0xFF0000) >> 16;
-		}
-		ofx.write((const char*)buffer, 4096 * 3);
+		unsigned int n = min(pos - at, (unsigned int)SFXR_BUFFER_CHUNK);
+		sfxrToPCM24(data + at, buffer, n, gain, bound());
+		ofx.write((const char*)buffer, (size_t)n * 3);
 	}
-	bpos = 0;
-	for (unsigned int i = 0; i < pos; i++)
-	{
-		uint32_t debug = (int32_t)((*pBlock)[i] * (float)0x7FFFFE);
-		buffer[bpos++] = debug & 0xFF;
-		buffer[bpos++] = (debug & 0xFF00) >> 8;
-		buffer[bpos++] = (debug & 0xFF0000) >> 16;
-	}
-	ofx.write((const char*)buffer, (size_t)pos * (size_t)3);
 #ifndef SFXR_STATIC_STREAM_BUFFER
 	delete[] buffer;
 #endif
 }
 
-void SfxrFloatBuffer::writeStream32(ostream& ofx)
+void SfxrFloatBuffer::writeStream32(ostream& ofx, float gain)
 {
 #ifndef SFXR_STATIC_STREAM_BUFFER
-	int16_t* buffer = new int16_t[4096];
+	int32_t* buffer = new int32_t[SFXR_BUFFER_CHUNK];
 #else
 	int32_t* buffer = (int32_t*)staticBuffer;
 #endif
-	for (const auto& block : bTable)
+	for (unsigned int at = 0; at < pos; at += SFXR_BUFFER_CHUNK)
 	{
-#pragma omp simd
-		for (int i = 0; i < 4096; i++)
-		{
-			buffer[i] = (int32_t)((*block)[i] * (float)0x7FFFFFFE);
-		}
-		ofx.write((const char*)buffer, 4096 * 2);
+		unsigned int n = min(pos - at, (unsigned int)SFXR_BUFFER_CHUNK);
+		sfxrToPCM32(data + at, buffer, n, gain, bound());
+		ofx.write((const char*)buffer, (size_t)n * 4);
 	}
-	for (unsigned int i = 0; i < pos; i++)
-		buffer[i] = (int32_t)((*pBlock)[i] * (float)0x7FFFFFFE);
-	ofx.write((const char*)buffer, (size_t)pos * 2);
 #ifndef SFXR_STATIC_STREAM_BUFFER
 	delete[] buffer;
 #endif
@@ -314,29 +771,16 @@ void SfxrFloatBuffer::writeStream32(ostream& ofx)
 
 void SfxrFloatBuffer::clear()
 {
-	for (const auto& block : bTable)
-		delete block;
-	bTable.clear();
+	// keep the allocation, reserve() trims it if the next sound is much shorter
 	pos = 0;
+	peak = 0.0f;
+	sumAbs = sumSquares = 0.0;
 }
 
 float SfxrFloatBuffer::operator[](unsigned int index)
 {
-	unsigned int block = index >> 12; // divide by 4096, shift 12 bits
-	unsigned int bpos = index % 4096;
-	if (bTable.size() == 0)
-	{
-		if (block > 0) throw new runtime_error("invalid index into SfxrFloatBuffer");
-		return (*pBlock)[bpos];
-	}
-	else
-	{
-		if (block > bTable.size() + 1) throw new runtime_error("invalid index into SfxrFloatBuffer");
-		if (block == bTable.size())
-			return (*pBlock)[bpos];
-		else
-			return (*bTable[block])[bpos];
-	}
+	if (index >= pos) throw new runtime_error("invalid index into SfxrFloatBuffer");
+	return data[index];
 }
 // *************************************************************************************
 
@@ -467,6 +911,143 @@ public:
 };
 
 // *************************************************************************************
+// noise tables: every render draws the same white (or pink) noise, from generators that start over each time, so the
+// first SFXR_NOISE_BLOCKS blocks of 32 values are made once, on first use, and read by every core from then on
+struct SfxrNoiseTable
+{
+	alignas(64) float values[SFXR_NOISE_BLOCKS * 32];
+	RandXS rxs;			// the generators as they are at the end of the table
+	PinkNumber pn;
+
+	static const SfxrNoiseTable& get(bool pink);
+	static const SfxrNoiseTable* make(bool pink);
+};
+
+const SfxrNoiseTable* SfxrNoiseTable::make(bool pink)
+{
+	SfxrNoiseTable* t = new SfxrNoiseTable();
+	t->rxs.seed(0);
+	for (int i = 0; i < SFXR_NOISE_BLOCKS * 32; i++)
+		t->values[i] = pink ? t->pn.getNextFloat() * 2.0f - 1.0f : t->rxs.randf() * 2.0f - 1.0f;
+	return t;
+}
+
+const SfxrNoiseTable& SfxrNoiseTable::get(bool pink)
+{
+	// function statics are made once, thread safe, and these are kept for the life of the program
+	if (pink)
+	{
+		static const SfxrNoiseTable* pinkTable = make(true);
+		return *pinkTable;
+	}
+	static const SfxrNoiseTable* whiteTable = make(false);
+	return *whiteTable;
+}
+
+// where a render is in its noise: a block in the table, then (for the rare sound that gets past it) its own block,
+// carrying on from the table's generators
+struct SfxrNoiseCursor
+{
+	const float* values = nullptr;
+	const SfxrNoiseTable* table = nullptr;
+	unsigned int block = 0;
+	bool pink = false;
+	RandXS rxs;
+	PinkNumber pn;
+	float own[32];
+
+	void start(bool _pink)
+	{
+		pink = _pink;
+		table = &SfxrNoiseTable::get(pink);
+		block = 0;
+		values = table->values;
+	}
+
+	inline void next()
+	{
+		if (++block < SFXR_NOISE_BLOCKS)
+		{
+			values += 32;
+			return;
+		}
+		if (block == SFXR_NOISE_BLOCKS)
+		{
+			rxs = table->rxs;
+			pn = table->pn;
+		}
+		for (int i = 0; i < 32; i++)
+			own[i] = pink ? pn.getNextFloat() * 2.0f - 1.0f : rxs.randf() * 2.0f - 1.0f;
+		values = own;
+	}
+};
+
+// *************************************************************************************
+// fast math, polynomial stand ins for the libm calls in the synth loop, used when SFXR_FAST_MATH is set
+// error bounds, measured against the double precision calls over the ranges the synth feeds them:
+//	fastSinTurns(t)		sin(2 * pi * t)			absolute error < 4e-6
+//	fastTan(x)			tan(x), x in [0,pi)		absolute error < 4e-7 * (1 + tan(x)^2), the reference tan() itself within 1e-3 of the pole
+//	fastPow(x, y)		pow(x, y), x > 0		relative error < 2e-6 * (1 + |y * log2(x)|)
+inline float fastSinTurns(float t)
+{
+	// reduce to [-0.25, 0.25] turns, where the odd taylor series to x^9 is good to 3.6e-6
+	t -= floor(t + 0.5f);
+	if (t > 0.25f) t = 0.5f - t;
+	if (t < -0.25f) t = -0.5f - t;
+	float x = t * (float)(2.0 * M_PI);
+	float x2 = x * x;
+	return x * (1.0f + x2 * (-1.0f / 6.0f + x2 * (1.0f / 120.0f + x2 * (-1.0f / 5040.0f + x2 * (1.0f / 362880.0f)))));
+}
+
+inline float fastTan(float x)
+{
+	// within 1e-3 of the pole hand over to the real thing: the spikes there are big enough that the hp filter
+	// keeps their rounding for the rest of the sound, so they have to match the reference to the bit (~0.06% of samples)
+	float c = fastSinTurns(0.25f - x * (float)(0.5 / M_PI));
+	if (fabs(c) < 1e-3f)
+		return tan(x);
+	return fastSinTurns(x * (float)(0.5 / M_PI)) / c;
+}
+
+inline float fastPow(float x, float y)
+{
+	// denormals, zero and negative bases (which give nan) go to the real thing
+	if (!(x >= 1.17549435e-38f))
+		return pow(x, y);
+	// log2(x): split off the exponent, with the mantissa in [sqrt(0.5), sqrt(2)) so the atanh series converges fast
+	uint32_t bits;
+	memcpy(&bits, &x, 4);
+	int e = (int)((bits >> 23) & 0xFF) - 127;
+	bits = (bits & 0x007FFFFF) | 0x3F800000;
+	float m;
+	memcpy(&m, &bits, 4);
+	if (m > 1.41421356f) { m *= 0.5f; e++; }
+	float s = (m - 1.0f) / (m + 1.0f);
+	float s2 = s * s;
+	float z = y * ((float)e + s * (2.88539008f + s2 * (0.961796694f + s2 * (0.577078016f + s2 * 0.412198583f))));
+	// exp2(z): 2^floor(z) straight into the exponent bits, times a taylor series for 2^fraction
+	if (z < -126.0f) return 0.0f;
+	if (z > 127.0f) z = 127.0f;
+	float n = floor(z);
+	float f = (z - n) * 0.693147181f;
+	float p = 1.0f + f * (1.0f + f * (0.5f + f * (1.0f / 6.0f + f * (1.0f / 24.0f + f * (1.0f / 120.0f + f * (1.0f / 720.0f + f * (1.0f / 5040.0f)))))));
+	bits = (uint32_t)((int)n + 127) << 23;
+	float scale;
+	memcpy(&scale, &bits, 4);
+	return p * scale;
+}
+
+// *************************************************************************************
+// stages of the synth that can be skipped for a sound, bit flagged to select a kernel
+#define SFXR_STAGE_LPF			1
+#define SFXR_STAGE_PHASER		2
+#define SFXR_STAGE_VIBRATO		4
+#define SFXR_STAGE_COUNT		8
+#define SFXR_KERNEL_FASTMATH	8	// not a stage, flags the SFXR_FAST_MATH kernels
+#define SFXR_KERNEL_MEASURE		16	// not a stage, runs only the control path to count samples, writes nothing
+#define SFXR_KERNEL_CONTROL		32	// not a stage, flags the SFXR_CONTROL_RATE kernels
+#define SFXR_WAVE_COUNT			9
+
 class SfxrCore
 {
 public:
@@ -487,8 +1068,7 @@ public:
 	float iphase = 0;
 	float phaser_buffer[1024];
 	float ipp = 0;
-	float noise_buffer[32];
-	float pink_noise_buffer[32];
+	SfxrNoiseCursor noise;		// white or pink, whichever the sound uses
 	float fltp = 0.0f;
 	float fltdp = 0.0f;
 	float fltw = 0.0f;
@@ -506,6 +1086,14 @@ public:
 	float arp_limit = 0;
 	double arp_mod = 0.0;
 
+	// SFXR_CONTROL_RATE: samples left to the next control point, and the steps each sample takes towards it
+	unsigned int ctl_left = 0;
+	double vib_s = 0.0, vib_c = 1.0;	// sin and cos of the vibrato's angle, turned a step each sample
+	double vib_sd = 0.0, vib_cd = 1.0;
+	float env_d = 0.0f;
+	float flthp_dd = 0.0f;
+	float fltw_dd = 0.0f;
+
 	int one_bit_noisestate = 0;
 	double one_bit_noise = 0.0;
 
@@ -520,23 +1108,43 @@ public:
 	bool playing_sample = false;
 
 	PCG32 pcg;
-	PinkNumber pn;
-	RandXS rxs;
 	Sfxr* parent = nullptr;
 	Sfxr::Parameters* param = nullptr;
 	SfxrFloatBuffer* buffer = nullptr;
 
+	// statistics of the samples from the last kernel call: peak, sum of |x| and sum of x^2
+	float block_peak = 0.0f;
+	double block_abs = 0.0;
+	double block_squares = 0.0;
+
+	// synthesis kernels, specialized per wave type and set of active stages, picked in resetSample()
+	typedef unsigned int (SfxrCore::*Kernel)(float* out, unsigned int length);
+	static const Kernel kernelTable[3][SFXR_WAVE_COUNT + 1][SFXR_STAGE_COUNT];	// [reference, SFXR_FAST_MATH, SFXR_CONTROL_RATE][wave type][stages]
+	Kernel kernel = nullptr;
+
 	SfxrCore();
+	~SfxrCore();
 
 	void seed(unsigned long long s);
 	void seed(const char* s);
+	void seed(unsigned long long s, unsigned long long index, unsigned int purpose);
 
 	void resetSample(bool restart);
-	void synthSample();
+	static void kernelKey(const Sfxr::Parameters* param, int& wave_type, unsigned int& stages);
+	void selectKernel();
+	unsigned int lengthHint();
+	unsigned int measure(Sfxr::Parameters* with = nullptr);	// exact sample count of a render of the current parameters (or with)
+	unsigned int cutoffJump(unsigned int limit);				// the same worked out for a plain geometric slide, 0 if it can't be
+	unsigned int cutoffWalk(unsigned int limit);				// where a freq_limit cutoff ends the sound, limit if it doesn't
+	unsigned int quietSamples();								// samples after the next one free of repeat, arpeggio and envelope events
+	template<int WAVE, unsigned int STAGES> void controlPoint(unsigned int n, float env_a, float env_s, float env_k, float env_len);
+	void synthSample();											// up to 4096 samples into buffer
+	unsigned int synthSample(float* out, unsigned int length);	// up to length samples into out, returns how many
+	template<int WAVE, unsigned int STAGES> unsigned int synthKernel(float* out, unsigned int length);
+	template<int WAVE, unsigned int STAGES> unsigned int synthFastKernel(float* out, unsigned int length) { return synthKernel<WAVE, STAGES | SFXR_KERNEL_FASTMATH>(out, length); }
+	template<int WAVE, unsigned int STAGES> unsigned int synthControlKernel(float* out, unsigned int length) { return synthKernel<WAVE, STAGES | SFXR_KERNEL_FASTMATH | SFXR_KERNEL_CONTROL>(out, length); }
 };
 
-#define xsrndf(range)  (rxs.randf() * range)
-
 SfxrCore::SfxrCore()
 {
 	buffer = new SfxrFloatBuffer();
@@ -546,12 +1154,11 @@ SfxrCore::SfxrCore()
 	#pragma omp simd
 	for (int i = 0; i < 1024; i++)
 		phaser_buffer[i] = 0.0f;
-	#pragma omp simd
-	for (int i = 0; i < 32; i++)
-	{
-		noise_buffer[i] = 0.0f;
-		pink_noise_buffer[i] = 0.0f;
-	}
+}
+
+SfxrCore::~SfxrCore()
+{
+	delete buffer;
 }
 
 void SfxrCore::seed(unsigned long long s)
@@ -567,11 +1174,31 @@ void SfxrCore::seed(const char* s)
 	A = (uint64_t)(s[0]) + ((uint64_t)(s[1]) << 8) + ((uint64_t)(s[2]) << 16) + ((uint64_t)(s[3]) << 24);
 	unsigned int i = 4;
 	while ((i < len) && (i < 8))
-		B += uint64_t(s[i]) << (i - 4);
+	{
+		B += uint64_t(s[i]) << ((i - 4) * 8);
+		i++;
+	}
 	if (B == 0) B = 0xBABABABA;
 	pcg.seed(0x6350502053667872 ^ A, 0x6D75726167616D69 & B);
 }
 
+// splitmix64's finalizer, a full avalanche of the bits
+static inline uint64_t sfxrMix(uint64_t x)
+{
+	x += 0x9E3779B97F4A7C15ull;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+	return x ^ (x >> 31);
+}
+
+void SfxrCore::seed(unsigned long long s, unsigned long long index, unsigned int purpose)
+{
+	// the key picks both where in the sequence to start and which of the 2^63 PCG streams to draw from, so keys that
+	// differ in any bit get unrelated draws, and what was generated before (or on what thread) doesn't matter
+	uint64_t k = sfxrMix(s ^ sfxrMix(index ^ sfxrMix((uint64_t)purpose)));
+	pcg.seed(sfxrMix(k), sfxrMix(k ^ 0x6D75726167616D69));
+}
+
 void SfxrCore::resetSample(bool restart)
 {
 	if (!restart) phase = 0;
@@ -590,9 +1217,9 @@ void SfxrCore::resetSample(bool restart)
 	arp_limit = trunc(pow(1.0f - CP(arp_speed), 2.0f) * 20000.0f + 32.0f);
 	if (CP(arp_speed) == 1.0f)
 		arp_limit = 0;
+	ctl_left = 0;
 	if (!restart)
 	{
-		rxs.seed(0); // reset random buffer generation
 		one_bit_noisestate = 1 << 14;
 		// reset filter
 		fltp = 0.0f;
@@ -625,205 +1252,991 @@ void SfxrCore::resetSample(bool restart)
 		for (int i = 0; i < 1024; i++)
 			phaser_buffer[i] = 0.0f;
 
-		for (int i = 0; i < 32; i++)
-		{
-			noise_buffer[i] = xsrndf(2.0f) - 1.0f;
-			pink_noise_buffer[i] = pn.getNextFloat() * 2.0f - 1.0f;
-		}
+		// noise starts over each render, only the sounds that use it touch (and so make) a table
+		if ((int)CP(wave_type) == SFXR_WAVE_NOISE || (int)CP(wave_type) == SFXR_WAVE_PINK)
+			noise.start((int)CP(wave_type) == SFXR_WAVE_PINK);
 
 		rep_time = 0;
 		rep_limit = trunc(pow(1.0f - CP(repeat_speed), 2.0f) * 20000.0f + 32.0f);
 		if (CP(repeat_speed) == 0.0f)
 			rep_limit = 0;
+
+		selectKernel();
+	}
+}
+
+void SfxrCore::kernelKey(const Sfxr::Parameters* param, int& wave_type, unsigned int& stages)
+{
+	wave_type = (int)CP(wave_type);
+	stages = 0;
+	// picking a stage that turns out to be a no-op is still exact, so these only need to be conservative
+	if (CP(lpf_freq) != 1.0f) stages |= SFXR_STAGE_LPF;
+	if (CP(pha_offset) != 0.0f || CP(pha_ramp) != 0.0f) stages |= SFXR_STAGE_PHASER;
+	if (CP(vib_strength) > 0.0f) stages |= SFXR_STAGE_VIBRATO;
+	// unknown wave types get the silent kernel, same as the old switch falling through
+	if (wave_type < 0 || wave_type >= SFXR_WAVE_COUNT) wave_type = SFXR_WAVE_COUNT;
+}
+
+void SfxrCore::selectKernel()
+{
+	int wave_type;
+	unsigned int stages;
+	kernelKey(param, wave_type, stages);
+	unsigned int mode = parent != nullptr ? parent->getMode() : 0;
+	int tier = (mode & SFXR_CONTROL_RATE) != 0 ? 2 : (mode & SFXR_FAST_MATH) != 0 ? 1 : 0;
+	kernel = kernelTable[tier][wave_type][stages];
+}
+
+unsigned int SfxrCore::lengthHint()
+{
+	// the envelope runs each stage for its length + 1 samples, then ends the sound, a freq_limit cutoff only makes it shorter
+	double samples = ((double)env_length[0] + (double)env_length[1] + (double)env_length[2] + 3.0) / (double)ratio;
+	return (unsigned int)samples + 1;
+}
+
+unsigned int SfxrCore::measure(Sfxr::Parameters* with)
+{
+	// work on a copy, this core (and its random and pink noise state) is left untouched
+	SfxrCore probe(*this);
+	probe.buffer = nullptr;
+	if (with != nullptr) probe.param = with;
+	probe.resetSample(false);
+	// while env_time still counts exactly in a float each envelope stage runs its length + 1 samples, so the
+	// envelope alone ends the sound here, and only a freq_limit cutoff can end it sooner
+	const float exact = 16777216.0f;
+	if (ratio == 1.0f && probe.env_length[0] < exact && probe.env_length[1] < exact && probe.env_length[2] < exact)
+	{
+		unsigned int total = (unsigned int)probe.env_length[0] + (unsigned int)probe.env_length[1] + (unsigned int)probe.env_length[2] + 3;
+		if (!(probe.CP(freq_limit) > 0.0f)) return total;
+		// the cutoff can't fire if the period starts at or under the limit and never grows: the slide stays in (0, 1] for
+		// the whole sound (the margin is far over its rounding) and an arpeggio either never comes or shortens the period
+		double lastSlide = probe.fslide + probe.fdslide * ((double)total + 1.0);
+		bool arpGrows = probe.arp_mod > 1.0 && probe.arp_limit != 0.0f && probe.arp_limit <= (float)total;
+		if (probe.fperiod <= probe.fmaxperiod && probe.fslide <= 1.0 && probe.fdslide <= 0.0 && lastSlide > 1e-9 && !arpGrows)
+			return total;
+		// a plain geometric slide has a closed form, anything else steps just the frequency slide, a handful of flops a sample
+		unsigned int cutoff = probe.cutoffJump(total);
+		return cutoff != 0 ? cutoff : probe.cutoffWalk(total);
+	}
+	probe.playing_sample = true;
+	unsigned int total = 0;
+	while (probe.playing_sample)
+		total += probe.synthKernel<SFXR_WAVE_COUNT, SFXR_KERNEL_MEASURE>(nullptr, SFXR_BUFFER_CHUNK * 64);
+	return total;
+}
+
+// first of steps 1..count where start * slide^k goes past limit: count + 1 if none, 0 if too close to call. start may be
+// off by err (relative), and each step of the real walk rounds by up to half an ulp, the margin covers both
+static unsigned int sfxrFirstCrossing(double start, double err, double slide, unsigned int count, double limit)
+{
+	if (count == 0) return 1;
+	if (slide <= 1.0)
+	{
+		// never growing, so the first step is the largest
+		double margin = err + 5.0 * DBL_EPSILON;
+		double first = start * slide;
+		if (first > limit * (1.0 + margin)) return 1;
+		return first < limit * (1.0 - margin) ? count + 1 : 0;
+	}
+	// solve start * slide^k = limit, then check the steps either side of it
+	double k = floor(log(limit / start) / log(slide)) + 1.0;
+	if (k < 1.0) k = 1.0;
+	if (k > (double)count) k = (double)count + 1.0;
+	double margin = err + (k + 4.0) * DBL_EPSILON;
+	double before = start * pow(slide, k - 1.0);
+	if (k > 1.0 && !(before < limit * (1.0 - margin))) return 0;
+	if (k > (double)count) return count + 1;
+	return start * pow(slide, k) > limit * (1.0 + margin) ? (unsigned int)k : 0;
+}
+
+unsigned int SfxrCore::cutoffJump(unsigned int limit)
+{
+	// no change in slide means fperiod is start * fslide^k, broken only by the arpeggio (one multiply, arp_limit steps in)
+	// and the repeat, which puts everything back at step rep_limit, so every cycle after the first is the same rep_limit
+	// steps and the first is one step shorter: either the cutoff comes within rep_limit steps or it never does
+	const float exact = 16777216.0f;
+	if (fdslide != 0.0 || !(fperiod > 0.0) || !(fslide > 0.0) || !(rep_limit < exact) || !(arp_limit < exact) || !isfinite(arp_mod))
+		return 0;
+	unsigned int cycle = rep_limit >= 1.0f ? (unsigned int)rep_limit : limit;
+	unsigned int arp = arp_limit >= 1.0f ? (unsigned int)arp_limit : 0;
+	unsigned int steps = min(cycle, limit);
+	// steps 1 .. arp - 1 slide from fperiod
+	unsigned int first = arp != 0 ? min(arp - 1, steps) : steps;
+	unsigned int at = sfxrFirstCrossing(fperiod, 0.0, fslide, first, fmaxperiod);
+	if (at == 0) return 0;
+	if (at > first && first < steps)
+	{
+		// then from the arpeggio on, starting from where the first run got to times arp_mod
+		if (!(arp_mod > 0.0)) return limit;
+		double start = fperiod * pow(fslide, (double)(arp - 1)) * arp_mod;
+		unsigned int rest = sfxrFirstCrossing(start, ((double)arp + 4.0) * DBL_EPSILON, fslide, steps - first, fmaxperiod);
+		if (rest == 0) return 0;
+		at = first + rest;
+	}
+	if (at > steps) return limit;
+	// the repeat's extra step, in the second cycle
+	if (rep_limit >= 1.0f && at == cycle) at = 2 * cycle - 1;
+	return min(at, limit);
+}
+
+unsigned int SfxrCore::cutoffWalk(unsigned int limit)
+{
+	// the frequency part of synthKernel() step for step, so it rounds the same and stops on the same sample
+	for (unsigned int i = 0; i < limit; i++)
+	{
+		rep_time += ratio;
+		if (rep_limit != 0.0f && rep_time >= rep_limit)
+		{
+			rep_time = 0.0f;
+			resetSample(true);
+		}
+		arp_time += ratio;
+		if (arp_limit != 0.0f && arp_time >= arp_limit)
+		{
+			arp_limit = 0.0f;
+			fperiod *= arp_mod;
+		}
+		fslide += fdslide * ratio;
+		fperiod *= fslide;
+		if (fperiod > fmaxperiod && CP(freq_limit) > 0.0f)
+			return i + 1;
+	}
+	return limit;
+}
+
+unsigned int SfxrCore::quietSamples()
+{
+	// the timers count in whole samples, exactly, only while the ratio is 1 and they stay under 2^24, otherwise
+	// every sample is checked. The next sample counts each timer to t + 1, the k-th one after it to t + 1 + k
+	const float exact = 16777216.0f;
+	if (ratio != 1.0f || env_stage >= 3 || !(env_length[env_stage] < exact) || !(rep_limit < exact) || !(arp_limit < exact))
+		return 0;
+	double quiet = (double)env_length[env_stage] - (double)env_time - 1.0;	// env fires on t > length
+	if (rep_limit != 0.0f)
+		quiet = min(quiet, (double)rep_limit - (double)rep_time - 2.0);		// repeat and arpeggio on t >= limit
+	if (arp_limit != 0.0f)
+		quiet = min(quiet, (double)arp_limit - (double)arp_time - 2.0);
+	return quiet > 0.0 ? (unsigned int)quiet : 0;
+}
+
+// SFXR_CONTROL_RATE, measured against the reference over 700 presets and randomized sounds: the same length every
+// time, error power median -72 dB, 95% of sounds under -54 dB, the worst -26 dB (a deep, resonant lowpass sweep).
+// Sounds with vibrato or a lowpass render 1.2x to 1.3x the samples a second, without either there's little to gain
+template<int WAVE, unsigned int STAGES>
+void SfxrCore::controlPoint(unsigned int n, float env_a, float env_s, float env_k, float env_len)
+{
+	// the modulators where they'd be on the last of the next n samples, worked out the reference way (the sweeps
+	// compound, so a pow() for n of them), and a straight line to there. Nothing here moves fperiod, the timers,
+	// the duty or the phaser, so the sound ends where the reference's does and square edges stay put
+	ctl_left = n;
+	double steps = (double)n * (double)ratio;
+	if constexpr ((STAGES & SFXR_STAGE_VIBRATO) != 0)
+	{
+		// the vibrato's angle goes in a line too, but its sine is the period and any error there drifts the pitch
+		// of the rest of the sound, so that is a rotation, exact to the angle, from the float steps of vib_phase
+		float to = vib_phase;
+		for (unsigned int k = 0; k < n; k++)
+			to += vib_speed * ratio;
+		double from = (double)vib_phase * (double)vib_amp, step = ((double)to * (double)vib_amp - from) / (double)n;
+		vib_s = sin(from);
+		vib_c = cos(from);
+		vib_sd = sin(step);
+		vib_cd = cos(step);
+	}
+	// the envelope is a line within a stage, and a run never crosses a stage, so this is its own first sample and slope
+	float first = env_a + (env_s - env_time / env_len) * 2.0f * env_k;
+	env_d = n > 1 ? ((env_a + (env_s - (env_time + (float)(steps - ratio)) / env_len) * 2.0f * env_k) - first) / (float)(n - 1) : 0.0f;
+	env_vol = first - env_d;
+	flthp_dd = 0.0f;
+	if (flthp_d != 0.0f)
+	{
+		float to = (float)((double)flthp * pow((double)flthp_d * (double)ratio, (double)n));
+		to = to < 0.00001f ? 0.00001f : to > 0.1f ? 0.1f : to;
+		flthp_dd = (to - flthp) / (float)n;
+	}
+	if constexpr ((STAGES & SFXR_STAGE_LPF) != 0)
+	{
+		// eight steps of the sweep a sample
+		float to = (float)((double)fltw * pow((double)fltw_d * (double)ratio, 8.0 * (double)n));
+		to = to < 0.0f ? 0.0f : to > 0.1f ? 0.1f : to;
+		fltw_dd = (to - fltw) / (float)n;
 	}
 }
 
 void SfxrCore::synthSample()
 {
-	int length = 4096;
+	// render straight into the free part of the buffer's current block
+	unsigned int room;
+	float* out = buffer->writeBlock(room);
+	unsigned int n = (this->*kernel)(out, room);
+	buffer->commit(n, block_peak, block_abs, block_squares);
+}
+
+unsigned int SfxrCore::synthSample(float* out, unsigned int length)
+{
+	return (this->*kernel)(out, length);
+}
+
+template<int WAVE, unsigned int STAGES>
+unsigned int SfxrCore::synthKernel(float* out, unsigned int length)
+{
+	unsigned int i;
 	float decimate = 0.0f;
 	float compress = CP(cs_compress);
+	float peak = 0.0f;
+	double sumAbs = 0.0, sumSquares = 0.0;
 
 	if (CP(cs_decimate) != 0)
 	{
 		decimate = (float(1 << (int)CP(cs_decimate)));
 	}
 
-	#pragma omp simd
-	for (int i = 0; i < length; i++)
+	i = 0;
+	while (i < length && playing_sample)
+	{
+		// events: the repeat, arpeggio and envelope timers are tested here against the value the next sample counts them
+		// to, a timer that fires is set to -ratio so that count brings it to exactly 0. Then the samples up to the next
+		// event run without looking at them, the envelope stage fixed for the run
+		if (rep_limit != 0.0f && rep_time + ratio >= rep_limit)
+		{
+			rep_time = -ratio;
+			resetSample(true);
+		}
+		if (arp_limit != 0.0f && arp_time + ratio >= arp_limit)
+		{
+			arp_limit = 0.0f;
+			fperiod *= arp_mod;
+		}
+		if (env_time + ratio > env_length[env_stage])
+		{
+			env_time = -ratio;
+			env_stage++;
+			if (env_stage == 3)
+				playing_sample = false;
+			ctl_left = 0;
+		}
+		// each stage's volume as env_a + pow(env_s - t / env_len, 1) * 2 * env_k, rounding as the stage's own formula
+		// does (the scale by +-0.5 and 2 is exact), stage 3 holds the last volume for the one sample it plays
+		float env_a = 0.0f, env_s = 0.0f, env_k = -0.5f, env_len = 1.0f;
+		if (env_stage < 3) env_len = env_length[env_stage];
+		if (env_stage == 1) { env_a = 1.0f; env_s = 1.0f; env_k = CP(env_punch); }
+		if (env_stage == 2) { env_s = 1.0f; env_k = 0.5f; }
+		if (env_stage == 3) { env_a = env_vol; env_k = 0.0f; }
+		unsigned int quiet = quietSamples();
+		unsigned int end = i + 1 + min(quiet, length - i - 1);
+		unsigned int next = i + 1 + quiet;	// the next event, which may be past this call
+		do
+		{
+			rep_time += ratio;
+			arp_time += ratio;
+			env_time += ratio;
+			// control points come every SFXR_CONTROL_SAMPLES and on each event, wherever a call starts or ends
+			if constexpr ((STAGES & SFXR_KERNEL_CONTROL) != 0)
+			{
+				if (ctl_left == 0)
+					controlPoint<WAVE, STAGES>(min((unsigned int)SFXR_CONTROL_SAMPLES, next - i), env_a, env_s, env_k, env_len);
+				ctl_left--;
+			}
+
+			// frequency envelopes/arpeggios
+			fslide += fdslide * ratio;
+			fperiod *= fslide;
+			if (fperiod > fmaxperiod)
+			{
+				fperiod = fmaxperiod;
+				if (CP(freq_limit) > 0.0f)
+					playing_sample = false;
+			}
+			float rfperiod = (float)fperiod;
+			if constexpr ((STAGES & SFXR_STAGE_VIBRATO) != 0 && (STAGES & SFXR_KERNEL_CONTROL) != 0)
+			{
+				vib_phase += vib_speed * ratio;
+				double s = vib_s * vib_cd + vib_c * vib_sd;
+				vib_c = vib_c * vib_cd - vib_s * vib_sd;
+				vib_s = s;
+				rfperiod = (float)(fperiod * (1.0 + vib_s));
+			}
+			else if constexpr ((STAGES & SFXR_STAGE_VIBRATO) != 0)
+			{
+				vib_phase += vib_speed * ratio;
+				// left exact even with SFXR_FAST_MATH: this feeds trunc() of the period, so any error drifts the phase of the whole sound
+				rfperiod = (float)(fperiod * (1.0 + sin(((double)vib_phase) * (double)vib_amp)));
+			}
+			period = (float)trunc(rfperiod);
+			if (period < 8) period = 8;
+			if constexpr (WAVE == SFXR_WAVE_SQUARE)
+			{
+				square_duty += square_slide * ratio;
+				if (square_duty < 0.0f) square_duty = 0.0f;
+				if (square_duty > 0.5f) square_duty = 0.5f;
+			}
+			// everything that can end the sound is above, so measuring stops here
+			if constexpr ((STAGES & SFXR_KERNEL_MEASURE) != 0)
+				continue;
+			// volume envelope
+			if constexpr ((STAGES & SFXR_KERNEL_CONTROL) != 0)
+				env_vol += env_d;
+			else
+				env_vol = env_a + pow(env_s - env_time / env_len, 1.0f) * 2.0f * env_k;
+
+			// phaser step
+			if constexpr ((STAGES & SFXR_STAGE_PHASER) != 0)
+			{
+				fphase += fdphase * ratio;
+				iphase = trunc(fabs(fphase));
+				if (iphase > 1023.0f) iphase = 1023.0f;
+			}
+
+			if constexpr ((STAGES & SFXR_KERNEL_CONTROL) != 0)
+			{
+				flthp += flthp_dd;
+				if constexpr ((STAGES & SFXR_STAGE_LPF) != 0)
+					fltw += fltw_dd;
+			}
+			else if (flthp_d != 0.0f)
+			{
+				flthp *= flthp_d * ratio;	// x Ratio?
+				if (flthp < 0.00001f) flthp = 0.00001f;
+				if (flthp > 0.1f) flthp = 0.1f;
+			}
+
+			float ssample = 0.0f;
+			for (int si = 0; si < 8; si++) // 8x supersampling
+			{
+				float sample = 0.0f;
+				phase += ratio;
+				if (phase >= period)
+				{
+					// phase is nearly always less than two periods, where the subtraction is exact and the same as fmod()
+					phase -= period;
+					if (phase >= period)
+						phase = fmod(phase,period);
+					if constexpr (WAVE == SFXR_WAVE_NOISE || WAVE == SFXR_WAVE_PINK)
+						noise.next();
+					else if constexpr (WAVE == SFXR_WAVE_1BIT)
+					{
+						const int feedBit = (one_bit_noisestate >> 1 & 1) ^ (one_bit_noisestate & 1);
+						one_bit_noisestate = one_bit_noisestate >> 1 | (feedBit << 14);
+						one_bit_noise = double(~one_bit_noisestate & 1) - 0.5;
+					}
+				}
+				// base waveform
+				if constexpr (WAVE == SFXR_WAVE_SQUARE)
+				{
+					float fp = phase / period;
+					if (fp < square_duty)
+						sample = 0.5f;
+					else
+						sample = -0.5f;
+				}
+				else if constexpr (WAVE == SFXR_WAVE_SAWTOOTH)
+				{
+					float fp = phase / period;
+					sample = 1.0f - fp * 2.0f;
+				}
+				else if constexpr (WAVE == SFXR_WAVE_SINE)
+				{
+					float fp = phase / period;
+					if constexpr ((STAGES & SFXR_KERNEL_FASTMATH) != 0)
+						sample = fastSinTurns(fp);
+					else
+						sample = (float)sin((double)fp * 2.0 * M_PI);
+				}
+				else if constexpr (WAVE == SFXR_WAVE_NOISE)
+					sample = noise.values[(int)(phase * 32.0f / period)];
+				else if constexpr (WAVE == SFXR_WAVE_TRIANGLE)
+					sample = fabs(1.0f - (phase / period) * 2.0f) - 1.0f;
+				else if constexpr (WAVE == SFXR_WAVE_PINK)
+					sample = noise.values[(int)(phase * 32.0f / period)];
+				else if constexpr (WAVE == SFXR_WAVE_TAN)
+				{
+					if constexpr ((STAGES & SFXR_KERNEL_FASTMATH) != 0)
+						sample += fastTan((float)M_PI * phase / period);
+					else
+						sample += tan((float)M_PI * phase / period);
+				}
+				else if constexpr (WAVE == SFXR_WAVE_BREAKER)
+				{
+					double amp = phase / period;
+					sample += (float)fabs(1.0 - amp * amp * 2.0) - 1.0f;
+				}
+				else if constexpr (WAVE == SFXR_WAVE_1BIT)
+					sample += (float)one_bit_noise;
+				// lp filter
+				float pp = fltp;
+				if constexpr ((STAGES & SFXR_STAGE_LPF) != 0)
+				{
+					if constexpr ((STAGES & SFXR_KERNEL_CONTROL) == 0)
+					{
+						fltw *= fltw_d * ratio;
+						if (fltw < 0.0f) fltw = 0.0f;
+						if (fltw > 0.1f) fltw = 0.1f;
+					}
+					fltdp += (sample - fltp) * fltw;
+					fltdp -= fltdp * fltdmp;
+				}
+				else
+				{
+					fltp = sample;
+					fltdp = 0.0f;
+				}
+				fltp += fltdp;
+				// hp filter
+				fltphp += (fltp - pp);
+				fltphp -= fltphp * flthp;
+				sample = fltphp;
+				// phaser, with no offset or sweep it just reads back the sample it wrote
+				if constexpr ((STAGES & SFXR_STAGE_PHASER) != 0)
+				{
+					phaser_buffer[(int)ipp & 1023] = sample;
+					sample += phaser_buffer[((int)ipp - (int)iphase + 1024) & 1023];
+					ipp = (float)((int)(ipp + ratio) & 1023);
+				}
+				else
+					sample += sample;
+				// final accumulation and envelope application
+				ssample += sample * env_vol;
+			}
+			ssample = ssample / 8.0f;
+
+			// decimate?
+			if (decimate != 0)
+				ssample = trunc(ssample * decimate) / decimate;
+
+			// compress?
+			if (compress != 0)
+			{
+				if constexpr ((STAGES & SFXR_KERNEL_FASTMATH) != 0)
+					ssample = fastPow(ssample, compress);
+				else
+					ssample = pow(ssample, compress);
+			}
+
+			ssample *= master_vol;
+			ssample *= 2.0f * sound_vol;
+
+			if (ssample > 1.0f) ssample = 1.0f;
+			if (ssample < -1.0f) ssample = -1.0f;
+			out[i] = ssample;
+
+			// statistics for SoundInfo, chains of their own so they ride along with the synth for free
+			float level = fabs(ssample);
+			peak = level > peak ? level : peak;
+			sumAbs += (double)level;
+			sumSquares += (double)level * (double)level;
+		} while (++i < end && playing_sample);
+	}
+	block_peak = peak;
+	block_abs = sumAbs;
+	block_squares = sumSquares;
+	return i;
+}
+
+// one row of kernels per wave type, one column per combination of SFXR_STAGE_* bits
+#define SFXR_KERNEL_ROW(fn, w) { &fn<w, 0>, &fn<w, 1>, &fn<w, 2>, &fn<w, 3>, &fn<w, 4>, &fn<w, 5>, &fn<w, 6>, &fn<w, 7> }
+#define SFXR_KERNEL_TABLE(fn) { \
+	SFXR_KERNEL_ROW(fn, SFXR_WAVE_SQUARE), \
+	SFXR_KERNEL_ROW(fn, SFXR_WAVE_SAWTOOTH), \
+	SFXR_KERNEL_ROW(fn, SFXR_WAVE_SINE), \
+	SFXR_KERNEL_ROW(fn, SFXR_WAVE_NOISE), \
+	SFXR_KERNEL_ROW(fn, SFXR_WAVE_TRIANGLE), \
+	SFXR_KERNEL_ROW(fn, SFXR_WAVE_PINK), \
+	SFXR_KERNEL_ROW(fn, SFXR_WAVE_TAN), \
+	SFXR_KERNEL_ROW(fn, SFXR_WAVE_BREAKER), \
+	SFXR_KERNEL_ROW(fn, SFXR_WAVE_1BIT), \
+	SFXR_KERNEL_ROW(fn, SFXR_WAVE_COUNT) }	// silent, for out of range wave types
+
+const SfxrCore::Kernel SfxrCore::kernelTable[3][SFXR_WAVE_COUNT + 1][SFXR_STAGE_COUNT] = {
+	SFXR_KERNEL_TABLE(SfxrCore::synthKernel),
+	SFXR_KERNEL_TABLE(SfxrCore::synthFastKernel),
+	SFXR_KERNEL_TABLE(SfxrCore::synthControlKernel)
+};
+// *************************************************************************************
+
+// *************************************************************************************
+// the same synth as SfxrCore, but with every per-voice value stored as an array with
+// one lane per sound, so a pass of SFXR_BATCH_LANES sounds runs through each stage
+// together. Lanes in a pass all share one kernel (wave type and active stages), which
+// keeps the lane loops free of per-sound branches so they vectorize.
+#ifdef __GNUC__
+// keep gcc from unrolling the lane loops into scalar code before it gets a chance to vectorize them
+#define SFXR_LANES _Pragma("GCC unroll 1") for (int l = 0; l < SFXR_BATCH_LANES; l++)
+#else
+#define SFXR_LANES for (int l = 0; l < SFXR_BATCH_LANES; l++)
+#endif
+
+class SfxrBatchCore
+{
+public:
+	float phase[SFXR_BATCH_LANES];
+	double fperiod[SFXR_BATCH_LANES];
+	double fmaxperiod[SFXR_BATCH_LANES];
+	bool freq_stop[SFXR_BATCH_LANES];
+	double fslide[SFXR_BATCH_LANES];
+	double fdslide[SFXR_BATCH_LANES];
+	float period[SFXR_BATCH_LANES];
+	float square_duty[SFXR_BATCH_LANES];
+	float square_slide[SFXR_BATCH_LANES];
+	int env_stage[SFXR_BATCH_LANES];
+	float env_time[SFXR_BATCH_LANES];
+	float env_length[3][SFXR_BATCH_LANES];
+	float env_limit[SFXR_BATCH_LANES];
+	float env_punch[SFXR_BATCH_LANES];
+	float env_vol[SFXR_BATCH_LANES];
+	float fphase[SFXR_BATCH_LANES];
+	float fdphase[SFXR_BATCH_LANES];
+	float iphase[SFXR_BATCH_LANES];
+	float phaser_buffer[1024][SFXR_BATCH_LANES];
+	float ipp[SFXR_BATCH_LANES];
+	float fltp[SFXR_BATCH_LANES];
+	float fltdp[SFXR_BATCH_LANES];
+	float fltw[SFXR_BATCH_LANES];
+	float fltw_d[SFXR_BATCH_LANES];
+	float fltdmp[SFXR_BATCH_LANES];
+	float fltphp[SFXR_BATCH_LANES];
+	float flthp[SFXR_BATCH_LANES];
+	float flthp_d[SFXR_BATCH_LANES];
+	float vib_phase[SFXR_BATCH_LANES];
+	float vib_speed[SFXR_BATCH_LANES];
+	float vib_amp[SFXR_BATCH_LANES];
+	float rep_time[SFXR_BATCH_LANES];
+	float rep_limit[SFXR_BATCH_LANES];
+	float arp_time[SFXR_BATCH_LANES];
+	float arp_limit[SFXR_BATCH_LANES];
+	double arp_mod[SFXR_BATCH_LANES];
+	int one_bit_noisestate[SFXR_BATCH_LANES];
+	double one_bit_noise[SFXR_BATCH_LANES];
+	float decimate[SFXR_BATCH_LANES];
+	float compress[SFXR_BATCH_LANES];
+	float sound_vol[SFXR_BATCH_LANES];
+	bool playing[SFXR_BATCH_LANES];
+
+	float master_vol = 0.25f;
+	float ratio = 1.0f;
+
+	SfxrNoiseCursor noise[SFXR_BATCH_LANES];
+	const Sfxr::Parameters* param[SFXR_BATCH_LANES];
+	unsigned int sound[SFXR_BATCH_LANES];
+	float* output[SFXR_BATCH_LANES];
+	unsigned int written[SFXR_BATCH_LANES];
+
+	// the sounds being rendered, and the queue of the ones left for the kernel that is running
+	const Sfxr::Parameters* params = nullptr;
+	const float* volumes = nullptr;
+	const vector<unsigned int>* queue = nullptr;
+	size_t next = 0;
+
+	// rendered sounds, in the order they were passed to SfxrBatch::render()
+	vector<vector<float>> outputs;
+
+	typedef void (SfxrBatchCore::*Kernel)();
+	static const Kernel kernelTable[SFXR_WAVE_COUNT + 1][SFXR_STAGE_COUNT];
+
+	void resetLane(int l, bool restart);
+	void startLane(int l);
+	void finishLane(int l);
+	void render(const Sfxr::Parameters* p, unsigned int count, const float* vol);
+	template<int WAVE, unsigned int STAGES> void synthKernel();
+};
+
+#define LP(x) param[l]->x
+
+void SfxrBatchCore::resetLane(int l, bool restart)
+{
+	if (!restart) phase[l] = 0;
+	fperiod[l] = 100.0 / ((double)LP(base_freq) * (double)LP(base_freq) + 0.001);
+	period[l] = trunc((float)fperiod[l]);
+	fmaxperiod[l] = 100.0 / ((double)LP(freq_limit) * (double)LP(freq_limit) + 0.001);
+	fslide[l] = 1.0 - pow((double)LP(freq_ramp), 3.0) * 0.01;
+	fdslide[l] = -pow((double)LP(freq_dramp), 3.0) * 0.000001;
+	square_duty[l] = 0.5f - LP(duty) * 0.5f;
+	square_slide[l] = -LP(duty_ramp) * 0.00005f;
+	if (LP(arp_mod) >= 0.0f)
+		arp_mod[l] = 1.0 - pow((double)LP(arp_mod), 2.0) * 0.9;
+	else
+		arp_mod[l] = 1.0 + pow((double)LP(arp_mod), 2.0) * 10.0;
+	arp_time[l] = 0;
+	arp_limit[l] = trunc(pow(1.0f - LP(arp_speed), 2.0f) * 20000.0f + 32.0f);
+	if (LP(arp_speed) == 1.0f)
+		arp_limit[l] = 0;
+	if (!restart)
 	{
-		if (!playing_sample)
+		one_bit_noisestate[l] = 1 << 14;
+		one_bit_noise[l] = 0.0;
+		fltp[l] = 0.0f;
+		fltdp[l] = 0.0f;
+		fltw[l] = pow(LP(lpf_freq), 3.0f) * 0.1f;
+		fltw_d[l] = 1.0f + LP(lpf_ramp) * 0.0001f;
+		fltdmp[l] = 5.0f / (1.0f + pow(LP(lpf_resonance), 2.0f) * 20.0f) * (0.01f + fltw[l]);
+		if (fltdmp[l] > 0.8f) fltdmp[l] = 0.8f;
+		fltphp[l] = 0.0f;
+		flthp[l] = pow(LP(hpf_freq), 2.0f) * 0.1f;
+		flthp_d[l] = 1.0f + LP(hpf_ramp) * 0.0003f;
+		vib_phase[l] = 0.0f;
+		vib_speed[l] = pow(LP(vib_speed), 2.0f) * 0.01f;
+		vib_amp[l] = LP(vib_strength) * 0.5f;
+		env_vol[l] = 0.0f;
+		env_stage[l] = 0;
+		env_time[l] = 0;
+		env_length[0][l] = trunc(LP(env_attack) * LP(env_attack) * 100000.0f);
+		env_length[1][l] = trunc(LP(env_sustain) * LP(env_sustain) * 100000.0f);
+		env_length[2][l] = trunc(LP(env_decay) * LP(env_decay) * 100000.0f);
+		env_limit[l] = env_length[0][l];
+		env_punch[l] = LP(env_punch);
+		freq_stop[l] = LP(freq_limit) > 0.0f;
+
+		fphase[l] = pow(LP(pha_offset), 2.0f) * 1020.0f;
+		if (LP(pha_offset) < 0.0f) fphase[l] = -fphase[l];
+		fdphase[l] = pow(LP(pha_ramp), 2.0f) * 1.0f;
+		if (LP(pha_ramp) < 0.0f) fdphase[l] = -fdphase[l];
+		iphase[l] = trunc(fabs(fphase[l]));
+		ipp[l] = 0;
+		for (int i = 0; i < 1024; i++)
+			phaser_buffer[i][l] = 0.0f;
+
+		if ((int)LP(wave_type) == SFXR_WAVE_NOISE || (int)LP(wave_type) == SFXR_WAVE_PINK)
+			noise[l].start((int)LP(wave_type) == SFXR_WAVE_PINK);
+
+		rep_time[l] = 0;
+		rep_limit[l] = trunc(pow(1.0f - LP(repeat_speed), 2.0f) * 20000.0f + 32.0f);
+		if (LP(repeat_speed) == 0.0f)
+			rep_limit[l] = 0;
+
+		decimate[l] = 0.0f;
+		if (LP(cs_decimate) != 0)
+			decimate[l] = (float(1 << (int)LP(cs_decimate)));
+		compress[l] = LP(cs_compress);
+	}
+}
+
+void SfxrBatchCore::startLane(int l)
+{
+	if (next >= queue->size())
+		return;
+	unsigned int index = (*queue)[next++];
+	sound[l] = index;
+	param[l] = &params[index];
+	sound_vol[l] = volumes ? volumes[index] : 0.5f;
+	resetLane(l, false);
+	playing[l] = true;
+	// a sound can't outlast its envelope, which is one sample past the end of each stage
+	outputs[index].resize((size_t)env_length[0][l] + (size_t)env_length[1][l] + (size_t)env_length[2][l] + 3);
+	output[l] = outputs[index].data();
+	written[l] = 0;
+}
+
+void SfxrBatchCore::finishLane(int l)
+{
+	outputs[sound[l]].resize(written[l]);
+	output[l] = nullptr;
+}
+
+void SfxrBatchCore::render(const Sfxr::Parameters* p, unsigned int count, const float* vol)
+{
+	params = p;
+	volumes = vol;
+	outputs.clear();
+	outputs.resize(count);
+	// group the sounds by kernel, so each pass can run one kernel over all its lanes
+	vector<unsigned int> order[SFXR_WAVE_COUNT + 1][SFXR_STAGE_COUNT];
+	for (unsigned int i = 0; i < count; i++)
+	{
+		int wave_type;
+		unsigned int stages;
+		SfxrCore::kernelKey(&params[i], wave_type, stages);
+		order[wave_type][stages].push_back(i);
+	}
+	for (int w = 0; w <= SFXR_WAVE_COUNT; w++)
+	{
+		for (unsigned int st = 0; st < SFXR_STAGE_COUNT; st++)
+		{
+			vector<unsigned int>& group = order[w][st];
+			if (group.empty())
+				continue;
+			queue = &group;
+			next = 0;
+			// idle lanes keep running the first sound of the group, so their state stays valid, but never output
+			SFXR_LANES
+			{
+				param[l] = &params[group[0]];
+				sound_vol[l] = 0.5f;
+				resetLane(l, false);
+				playing[l] = false;
+				output[l] = nullptr;
+			}
+			(this->*kernelTable[w][st])();
+		}
+	}
+}
+
+template<int WAVE, unsigned int STAGES>
+void SfxrBatchCore::synthKernel()
+{
+	bool emit[SFXR_BATCH_LANES];
+	float ssample[SFXR_BATCH_LANES];
+
+	for (;;)
+	{
+		// finished lanes pick up the next sound right away
+		SFXR_LANES
+		{
+			if (!playing[l] && output[l] != nullptr)
+				finishLane(l);
+			if (!playing[l])
+				startLane(l);
+		}
+		bool any = false, compressed = false;
+		SFXR_LANES
+		{
+			emit[l] = playing[l];
+			any |= playing[l];
+			compressed |= compress[l] != 0;
+		}
+		if (!any)
 			break;
 
-		rep_time += ratio;
-		if (rep_limit != 0.0f && rep_time >= rep_limit)
+		// per sample control, written as selects rather than branches so every lane runs the same
+		// instructions. Idle lanes run it too, their state is thrown away when they start a sound.
+		// repeats are rare, so only spot them here and reset those lanes outside the lane loop
+		int repeat = 0;
+		SFXR_LANES
+		{
+			rep_time[l] += ratio;
+			repeat |= (rep_limit[l] != 0.0f) & (rep_time[l] >= rep_limit[l]);
+		}
+		if (repeat)
 		{
-			rep_time = 0.0f;
-			resetSample(true);
+			SFXR_LANES
+			{
+				if (rep_limit[l] != 0.0f && rep_time[l] >= rep_limit[l])
+				{
+					rep_time[l] = 0.0f;
+					resetLane(l, true);
+				}
+			}
 		}
-
 		// frequency envelopes/arpeggios
-		arp_time += ratio;
-		if (arp_limit != 0.0f && arp_time >= arp_limit)
+		SFXR_LANES
 		{
-			arp_limit = 0.0f;
-			fperiod *= arp_mod;
+			arp_time[l] += ratio;
+			bool arp = (arp_limit[l] != 0.0f) & (arp_time[l] >= arp_limit[l]);
+			arp_limit[l] = arp ? 0.0f : arp_limit[l];
+			double fa = fperiod[l] * arp_mod[l];
+			double fp = arp ? fa : fperiod[l];
+			fslide[l] += fdslide[l] * ratio;
+			fp *= fslide[l];
+			bool over = fp > fmaxperiod[l];
+			fperiod[l] = over ? fmaxperiod[l] : fp;
+			playing[l] = playing[l] & !(over & freq_stop[l]);
 		}
-		fslide += fdslide * ratio;
-		fperiod *= fslide;
-		if (fperiod > fmaxperiod)
+		float rfperiod[SFXR_BATCH_LANES];
+		SFXR_LANES
+			rfperiod[l] = (float)fperiod[l];
+		if constexpr ((STAGES & SFXR_STAGE_VIBRATO) != 0)
 		{
-			fperiod = fmaxperiod;
-			if (CP(freq_limit) > 0.0f)
-				playing_sample = false;
+			// sin() doesn't vectorize, so this is the one control loop that skips idle lanes
+			SFXR_LANES
+			{
+				if (!emit[l])
+					continue;
+				vib_phase[l] += vib_speed[l] * ratio;
+				rfperiod[l] = (float)(fperiod[l] * (1.0 + sin(((double)vib_phase[l]) * (double)vib_amp[l])));
+			}
 		}
-		float rfperiod = (float)fperiod;
-		if (vib_amp > 0.0f)
+		SFXR_LANES
 		{
-			vib_phase += vib_speed * ratio;
-			rfperiod = (float)(fperiod * (1.0 + sin(((double)vib_phase) * (double)vib_amp)));
+			float p = (float)trunc(rfperiod[l]);
+			period[l] = p < 8 ? 8 : p;
+			if constexpr (WAVE == SFXR_WAVE_SQUARE)
+			{
+				float d = square_duty[l] + square_slide[l] * ratio;
+				d = d < 0.0f ? 0.0f : d;
+				square_duty[l] = d > 0.5f ? 0.5f : d;
+			}
 		}
-		period = (float)trunc(rfperiod);
-		if (period < 8) period = 8;
-		square_duty += square_slide * ratio;
-		if (square_duty < 0.0f) square_duty = 0.0f;
-		if (square_duty > 0.5f) square_duty = 0.5f;
-		// volume envelope
-		env_time += ratio;
-		if (env_time > env_length[env_stage])
+		// volume envelope, env_limit is the length of the current stage
+		SFXR_LANES
 		{
-			env_time = 0.0f;
-			env_stage++;
-			if (env_stage == 3)
-				playing_sample = false;
+			float t = env_time[l] + ratio;
+			bool next = t > env_limit[l];
+			t = next ? 0.0f : t;
+			int stage = env_stage[l] + (next ? 1 : 0);
+			env_time[l] = t;
+			env_stage[l] = stage;
+			playing[l] = playing[l] & !(next & (stage == 3));
+			env_limit[l] = stage == 1 ? env_length[1][l] : (stage == 2 ? env_length[2][l] : env_length[0][l]);
+			float v0 = t / env_length[0][l];
+			float v1 = 1.0f + (1.0f - t / env_length[1][l]) * 2.0f * env_punch[l];
+			float v2 = 1.0f - t / env_length[2][l];
+			env_vol[l] = stage == 0 ? v0 : (stage == 1 ? v1 : (stage == 2 ? v2 : env_vol[l]));
 		}
-		if (env_stage == 0)
-			env_vol = env_time / env_length[0];
-		if (env_stage == 1)
-			env_vol = 1.0f + pow(1.0f - env_time / env_length[1], 1.0f) * 2.0f * CP(env_punch);
-		if (env_stage == 2)
-			env_vol = 1.0f - env_time / env_length[2];
-
-		// phaser step
-		fphase += fdphase * ratio;
-		iphase = trunc(fabs(fphase));
-		if (iphase > 1023.0f) iphase = 1023.0f;
-
-		if (flthp_d != 0.0f)
+		// phaser and hp sweeps
+		SFXR_LANES
 		{
-			flthp *= flthp_d * ratio;	// x Ratio?
-			if (flthp < 0.00001f) flthp = 0.00001f;
-			if (flthp > 0.1f) flthp = 0.1f;
+			if constexpr ((STAGES & SFXR_STAGE_PHASER) != 0)
+			{
+				fphase[l] += fdphase[l] * ratio;
+				float ip = trunc(fabs(fphase[l]));
+				iphase[l] = ip > 1023.0f ? 1023.0f : ip;
+			}
+			float h = flthp[l] * (flthp_d[l] * ratio);
+			h = h < 0.00001f ? 0.00001f : h;
+			h = h > 0.1f ? 0.1f : h;
+			flthp[l] = flthp_d[l] != 0.0f ? h : flthp[l];
 		}
 
-		float ssample = 0.0f;
-		int wave_type = (int)CP(wave_type);
+		// the supersample loop works on local copies of the hot lane state, so nothing aliases and the lane loops vectorize
+		float ph[SFXR_BATCH_LANES], per[SFXR_BATCH_LANES], duty[SFXR_BATCH_LANES], vol[SFXR_BATCH_LANES];
+		float lp[SFXR_BATCH_LANES], ldp[SFXR_BATCH_LANES], lw[SFXR_BATCH_LANES], hp[SFXR_BATCH_LANES], hpw[SFXR_BATCH_LANES];
+		int iph[SFXR_BATCH_LANES];
+		SFXR_LANES
+		{
+			ph[l] = phase[l];
+			per[l] = period[l];
+			duty[l] = square_duty[l];
+			vol[l] = env_vol[l];
+			lp[l] = fltp[l];
+			ldp[l] = fltdp[l];
+			lw[l] = fltw[l];
+			hp[l] = fltphp[l];
+			hpw[l] = flthp[l];
+			iph[l] = (int)iphase[l];
+			ssample[l] = 0.0f;
+		}
 		for (int si = 0; si < 8; si++) // 8x supersampling
 		{
-			float sample = 0.0f;
-			phase += ratio;
-			if (phase >= period)
+			int wrap = 0;
+#pragma omp simd reduction(|:wrap)
+			SFXR_LANES
 			{
-				phase = fmod(phase,period);
-				if (wave_type == SFXR_WAVE_NOISE)
-					for (int i = 0; i < 32; i++)
-						noise_buffer[i] = xsrndf(2.0f) - 1.0f;
-				else if (wave_type == SFXR_WAVE_PINK)
-				{
-					for (int i = 0; i < 32; i++)
-						pink_noise_buffer[i] = pn.getNextFloat() * 2.0f - 1.0f;
-				}
-				else if (wave_type == SFXR_WAVE_1BIT)
+				ph[l] += ratio;
+				wrap |= ph[l] >= per[l] ? 1 : 0;
+			}
+			// period wraps are rare, so handle them lane by lane outside the vector loop
+			if (wrap)
+			{
+				SFXR_LANES
 				{
-					const int feedBit = (one_bit_noisestate >> 1 & 1) ^ (one_bit_noisestate & 1);
-					one_bit_noisestate = one_bit_noisestate >> 1 | (feedBit << 14);
-					one_bit_noise = double(~one_bit_noisestate & 1) - 0.5;
+					if (ph[l] >= per[l])
+					{
+						ph[l] -= per[l];
+						if (ph[l] >= per[l])
+							ph[l] = fmod(ph[l], per[l]);
+						if constexpr (WAVE == SFXR_WAVE_NOISE || WAVE == SFXR_WAVE_PINK)
+							noise[l].next();
+						else if constexpr (WAVE == SFXR_WAVE_1BIT)
+						{
+							const int feedBit = (one_bit_noisestate[l] >> 1 & 1) ^ (one_bit_noisestate[l] & 1);
+							one_bit_noisestate[l] = one_bit_noisestate[l] >> 1 | (feedBit << 14);
+							one_bit_noise[l] = double(~one_bit_noisestate[l] & 1) - 0.5;
+						}
+					}
 				}
 			}
-			// base waveform
-			float fp = phase / period;
-			double amp;
-			switch (wave_type)
+#pragma omp simd
+			SFXR_LANES
 			{
-			case SFXR_WAVE_SQUARE:
-				if (fp < square_duty)
-					sample = 0.5f;
+				float sample = 0.0f;
+				if constexpr (WAVE == SFXR_WAVE_SQUARE)
+					sample = (ph[l] / per[l] < duty[l]) ? 0.5f : -0.5f;
+				else if constexpr (WAVE == SFXR_WAVE_SAWTOOTH)
+					sample = 1.0f - (ph[l] / per[l]) * 2.0f;
+				else if constexpr (WAVE == SFXR_WAVE_SINE)
+					sample = (float)sin((double)(ph[l] / per[l]) * 2.0 * M_PI);
+				else if constexpr (WAVE == SFXR_WAVE_NOISE)
+					sample = noise[l].values[(int)(ph[l] * 32.0f / per[l])];
+				else if constexpr (WAVE == SFXR_WAVE_TRIANGLE)
+					sample = fabs(1.0f - (ph[l] / per[l]) * 2.0f) - 1.0f;
+				else if constexpr (WAVE == SFXR_WAVE_PINK)
+					sample = noise[l].values[(int)(ph[l] * 32.0f / per[l])];
+				else if constexpr (WAVE == SFXR_WAVE_TAN)
+					sample += tan((float)M_PI * ph[l] / per[l]);
+				else if constexpr (WAVE == SFXR_WAVE_BREAKER)
+				{
+					double amp = ph[l] / per[l];
+					sample += (float)fabs(1.0 - amp * amp * 2.0) - 1.0f;
+				}
+				else if constexpr (WAVE == SFXR_WAVE_1BIT)
+					sample += (float)one_bit_noise[l];
+				// lp filter
+				float pp = lp[l];
+				if constexpr ((STAGES & SFXR_STAGE_LPF) != 0)
+				{
+					float w = lw[l] * (fltw_d[l] * ratio);
+					w = w < 0.0f ? 0.0f : w;
+					w = w > 0.1f ? 0.1f : w;
+					lw[l] = w;
+					float dp = ldp[l] + (sample - lp[l]) * w;
+					dp -= dp * fltdmp[l];
+					ldp[l] = dp;
+				}
 				else
-					sample = -0.5f;
-				break;
-			case SFXR_WAVE_SAWTOOTH:
-				sample = 1.0f - fp * 2.0f;
-				break;
-			case SFXR_WAVE_SINE:
-				sample = (float)sin((double)fp * 2.0 * M_PI);
-				break;
-			case SFXR_WAVE_NOISE:
-				sample = noise_buffer[(int)(phase * 32.0f / period)];
-				break;
-			case SFXR_WAVE_TRIANGLE:
-				sample = fabs(1.0f - (phase / period) * 2.0f) - 1.0f;
-				break;
-			case SFXR_WAVE_PINK:
-				sample = pink_noise_buffer[(int)(phase * 32.0f / period)];
-				break;
-			case SFXR_WAVE_TAN:
-				sample += tan((float)M_PI * phase / period);
-				break;
-			case SFXR_WAVE_BREAKER:
-				amp = phase / period;
-				sample += (float)fabs(1.0 - amp * amp * 2.0) - 1.0f;
-				break;
-			case SFXR_WAVE_1BIT:
-				sample += (float)one_bit_noise;
-				break;
-			}
-			// lp filter
-			float pp = fltp;
-			fltw *= fltw_d * ratio;
-			if (fltw < 0.0f) fltw = 0.0f;
-			if (fltw > 0.1f) fltw = 0.1f;
-			if (CP(lpf_freq) != 1.0f)
-			{
-				fltdp += (sample - fltp) * fltw;
-				fltdp -= fltdp * fltdmp;
+				{
+					lp[l] = sample;
+					ldp[l] = 0.0f;
+				}
+				lp[l] += ldp[l];
+				// hp filter
+				float h = hp[l] + (lp[l] - pp);
+				h -= h * hpw[l];
+				hp[l] = h;
+				sample = h;
+				// phaser
+				if constexpr ((STAGES & SFXR_STAGE_PHASER) != 0)
+				{
+					int wp = (int)ipp[l] & 1023;
+					phaser_buffer[wp][l] = sample;
+					sample += phaser_buffer[(wp - iph[l] + 1024) & 1023][l];
+					ipp[l] = (float)((int)(ipp[l] + ratio) & 1023);
+				}
+				else
+					sample += sample;
+				ssample[l] += sample * vol[l];
 			}
-			else
+		}
+		SFXR_LANES
+		{
+			phase[l] = ph[l];
+			fltp[l] = lp[l];
+			fltdp[l] = ldp[l];
+			fltw[l] = lw[l];
+			fltphp[l] = hp[l];
+		}
+
+		// decimate, compress, volume and clip, then hand the sample to the lanes still playing
+		SFXR_LANES
+		{
+			float s = ssample[l] / 8.0f;
+			s = decimate[l] != 0 ? trunc(s * decimate[l]) / decimate[l] : s;
+			ssample[l] = s;
+		}
+		if (compressed)
+		{
+			SFXR_LANES
 			{
-				fltp = sample;
-				fltdp = 0.0f;
+				if (compress[l] != 0)
+					ssample[l] = pow(ssample[l], compress[l]);
 			}
-			fltp += fltdp;
-			// hp filter
-			fltphp += (fltp - pp);
-			fltphp -= fltphp * flthp;
-			sample = fltphp;
-			// phaser
-			phaser_buffer[(int)ipp & 1023] = sample;
-			sample += phaser_buffer[((int)ipp - (int)iphase + 1024) & 1023];
-			ipp = (float)((int)(ipp + ratio) & 1023);
-			// final accumulation and envelope application
-			ssample += sample * env_vol;
 		}
-		ssample = ssample / 8.0f;
-
-		// decimate?
-		if (decimate != 0)
-			ssample = trunc(ssample * decimate) / decimate;
-
-		// compress?
-		if (compress != 0)
-			ssample = pow(ssample, compress);
-
-		ssample *= master_vol;
-		ssample *= 2.0f * sound_vol;
-
-		if (ssample > 1.0f) ssample = 1.0f;
-		if (ssample < -1.0f) ssample = -1.0f;
-		(*buffer) << ssample;
+		SFXR_LANES
+		{
+			float s = ssample[l] * master_vol;
+			s *= 2.0f * sound_vol[l];
+			s = s > 1.0f ? 1.0f : s;
+			ssample[l] = s < -1.0f ? -1.0f : s;
+		}
+		SFXR_LANES
+		{
+			if (emit[l])
+				output[l][written[l]++] = ssample[l];
+		}
 	}
 }
+
+const SfxrBatchCore::Kernel SfxrBatchCore::kernelTable[SFXR_WAVE_COUNT + 1][SFXR_STAGE_COUNT] = SFXR_KERNEL_TABLE(SfxrBatchCore::synthKernel);
 // *************************************************************************************
 
+
 // *************************************************************************************
 // Sfxr class itself!
 Sfxr::Sfxr(unsigned int sample_rate, unsigned int bit_depth)
@@ -835,6 +2248,32 @@ Sfxr::Sfxr(unsigned int sample_rate, unsigned int bit_depth)
 	setPCM(sample_rate, bit_depth);
 }
 
+Sfxr::~Sfxr()
+{
+	delete core;
+	if (dataBytes != nullptr && dataCopied == true) delete[] dataBytes;
+}
+
+size_t Sfxr::poolBytes()
+{
+	SfxrSamplePool* pool = SfxrSamplePool::local();
+	return pool != nullptr ? pool->held : 0;
+}
+
+void Sfxr::setPoolLimit(size_t bytes)
+{
+	SfxrSamplePool* pool = SfxrSamplePool::local();
+	if (pool == nullptr) return;
+	pool->limit = bytes;
+	pool->trim(bytes);
+}
+
+void Sfxr::trimPool(size_t keep)
+{
+	SfxrSamplePool* pool = SfxrSamplePool::local();
+	if (pool != nullptr) pool->trim(keep);
+}
+
 Sfxr::Parameters* Sfxr::getParameters()
 {
 	return &paramData;
@@ -850,6 +2289,11 @@ void Sfxr::seed(const char* s)
 	core->seed(s);
 }
 
+void Sfxr::seed(unsigned long long s, unsigned long long index, unsigned int purpose)
+{
+	core->seed(s, index, purpose);
+}
+
 void Sfxr::setMode(unsigned int m)
 {
 	mode = m;
@@ -907,6 +2351,16 @@ void Sfxr::setPCM(unsigned int sample_rate, unsigned int bit_depth)
 	}
 }
 
+unsigned int Sfxr::getSampleRate()
+{
+	return (unsigned int)core->out_freq;
+}
+
+unsigned int Sfxr::getBitDepth()
+{
+	return (unsigned int)core->wav_bits;
+}
+
 unsigned int Sfxr::sizeWaveFloatString()
 {
 	assertSynthed();
@@ -920,6 +2374,23 @@ unsigned int Sfxr::sizeWaveString()
 }
 
 unsigned int Sfxr::size(ExportFormat f)
+{
+	return sizeFor(f, totalSamples);
+}
+
+unsigned int Sfxr::predictLength(const Parameters& p)
+{
+	Parameters params = p;
+	if (mode & SFXR_WORD_MODE) lockWordParams(params);
+	return core->measure(&params);
+}
+
+unsigned int Sfxr::predictSize(ExportFormat f, const Parameters& p)
+{
+	return sizeFor(f, predictLength(p));
+}
+
+unsigned int Sfxr::sizeFor(ExportFormat f, unsigned int samples)
 {
 	unsigned int sampleSize = 1, headerSize = 0;
 	switch (f)
@@ -932,12 +2403,12 @@ unsigned int Sfxr::size(ExportFormat f)
 	case ExportFormat::PCM32:
 	case ExportFormat::FLOAT: sampleSize = 4; break;
 	}
-	return sampleSize * core->buffer->size() + headerSize;
+	return sampleSize * samples + headerSize;
 }
 
 void Sfxr::setData(void* data, unsigned int size, bool copy)
 {
-	if (dataBytes != nullptr && dataCopied == true) delete dataBytes;
+	if (dataBytes != nullptr && dataCopied == true) delete[] dataBytes;
 	dataCopied = copy;
 	if (data == nullptr || size == 0)
 	{
@@ -968,7 +2439,26 @@ unsigned int Sfxr::getDataSize()
 	return dataSize;
 }
 
+void Sfxr::setVolume(float v)
+{
+	created = rebuild = true;
+	core->sound_vol = v;
+}
+
+float Sfxr::getVolume()
+{
+	return core->sound_vol;
+}
+
 void Sfxr::assertSynthed()
+{
+	if (!created) create(fromWhat);
+	else if (rebuild) create();
+	// only measured (SFXR_DIRECT_PCM), but this needs the float samples
+	if (pending) render();
+}
+
+void Sfxr::assertCreated()
 {
 	if (!created) create(fromWhat);
 	else if (rebuild) create();
@@ -1088,128 +2578,132 @@ void Sfxr::randomize()
 	PV(arp_mod) = frnd(2.0f) - 1.0f;
 }
 
-bool Sfxr::loadStream(istream& ifs)
+// SW records keep each value as 16 bit fixed point, thousandths from -32.767 to 32.767
+static int16_t sfxrToWord(float f)
+{
+	long w = lround(f * 1000.0f);
+	return (int16_t)(w < -32767 ? -32767 : (w > 32767 ? 32767 : w));
+}
+
+static float sfxrFromWord(int16_t w)
 {
+	return (float)w / 1000.0f;
+}
+
+bool Sfxr::loadBuffer(const void* data, size_t size, bool copy)
+{
+	// fields are memcpy'd out, the record need not be aligned
+	const char* src = (const char*)data;
+	unsigned int sz, head;
+	if (data == nullptr) return false;
 	if (mode & SFXR_WORD_MODE)
 	{
-		char head[2] = { 0, 0 };
 		int16_t version, x;
-		uint16_t sz;
+		uint16_t sz16;
 		int16_t wordTable[32];
-		ifs.read(head, 2);
-		if (head[0] != 'S' || head[1] != 'W') return false;
-		ifs.read((char*)&version, 2);
+		if (size < 72 || src[0] != 'S' || src[1] != 'W') return false;
+		memcpy(&version, src + 2, 2);
 		if ((version < 100) || (version >= 199)) return false;
-		ifs.read((char*)&sz, 2);
-		if (sz < 72) return false;
-		ifs.read((char*)&wordTable, sizeof(wordTable));
-		ifs.read((char*)&x, 2);
-		core->sound_vol = (float)(x * 32000);
+		memcpy(&sz16, src + 4, 2);
+		if (sz16 < 72 || sz16 > size) return false;
+		memcpy(wordTable, src + 6, sizeof(wordTable));
+		memcpy(&x, src + 70, 2);
+		core->sound_vol = sfxrFromWord(x);
 		// fill in the actual float values
 		float* p = (float*)&paramData;
-		for (int i = 0; i < 8; i++)
-		{
-			int index = i * 4;
-			p[i] = (float)wordTable[i] * 32000.0f;
-			p[i+1] = (float)wordTable[i+1] * 32000.0f;
-			p[i+2] = (float)wordTable[i+2] * 32000.0f;
-			p[i+3] = (float)wordTable[i+3] * 32000.0f;
-		}
-		// read anymore data attached to the sound!
-		if (sz > 72)
-		{
-			unsigned int to_read = sz - 72;
-			setData(nullptr, 0);
-			dataBytes = new char[to_read];
-			ifs.read(dataBytes, to_read);
-			dataSize = to_read;
-			dataCopied = true;	// we own the data, so make sure we free it if needed!
-		}
-		created = true;
-		rebuild = true;
-		return true;
+		for (int i = 0; i < 32; i++)
+			p[i] = sfxrFromWord(wordTable[i]);
+		sz = sz16;
+		head = 72;
 	}
 	else
 	{
-		char head[4] = { 0, 0, 0, 0 };
-		unsigned int sz;
-		float version = 0;
-		ifs.read(head, 4);
-		if (head[0] != 'S' || head[1] != 'F') return false;
-		ifs.read((char*)&version, 4);
+		float version;
+		if (size < 144 || src[0] != 'S' || src[1] != 'F') return false;
+		memcpy(&version, src + 4, 4);
 		if ((version < 1.0f) || (version >= 2.0f)) return false;
-		ifs.read((char*)&sz, 4);
-		if (sz < 144 || sz > 4194304) return false;	// just for our sanity, limit the data to 4MB
-		ifs.read((char*)&paramData, sizeof(paramData));
-		ifs.read((char*)&(core->sound_vol), 4);
-		// read anymore data attached to the sound!
-		if (sz > 144)
-		{
-			unsigned int to_read = sz - 144;
-			setData(nullptr, 0);
-			dataBytes = new char[to_read];
-			ifs.read(dataBytes, to_read);
-			dataSize = to_read;
-			dataCopied = true;	// we own the data, so make sure we free it if needed!
-		}
-		created = true;
-		rebuild = true;
-		return true;
+		memcpy(&sz, src + 8, 4);
+		if (sz < 144 || sz > 4194304 || sz > size) return false;	// just for our sanity, limit the data to 4MB
+		memcpy(&paramData, src + 12, sizeof(paramData));
+		memcpy(&(core->sound_vol), src + 140, 4);
+		head = 144;
 	}
+	// anymore data attached to the sound, copied so we own it, or used right where it is
+	if (sz > head) setData((void*)(src + head), sz - head, copy);
+	else setData(nullptr, 0);
+	created = true;
+	rebuild = true;
+	return true;
 }
 
-bool Sfxr::loadFile(const char* fname)
-{
-	ifstream ifs(fname, ios::binary);
-	return loadStream(ifs);
-}
-
-bool Sfxr::writeStream(ostream& ofs)
+bool Sfxr::writeBuffer(void* data, size_t size)
 {
+	char* dst = (char*)data;
+	unsigned int sz = writeSize(), head;
+	if (data == nullptr || size < sz) return false;
 	if (mode & SFXR_WORD_MODE)
 	{
-		char head[2] = { 'S', 'W' };
 		int16_t version = 100, x;
-		uint16_t sz = writeSize();
+		uint16_t sz16 = (uint16_t)sz;
 		int16_t wordTable[32];
-		ofs.write(head, 2);
-		ofs.write((const char*)&version, 2);
-		ofs.write((const char*)&sz, 2);
 		// build the output word table
-		float* p = (float*)&paramData;
-		for (int i = 0; i < 8; i++)
-		{
-			int index = i * 4;
-			wordTable[i] = (int16_t)(p[i] * 32000.0f);
-			wordTable[i+1] = (int16_t)(p[i+1] * 32000.0f);
-			wordTable[i+2] = (int16_t)(p[i+2] * 32000.0f);
-			wordTable[i+3] = (int16_t)(p[i+3] * 32000.0f);
-		}
-		ofs.write((const char*)&wordTable, sizeof(wordTable));
-		x = (int16_t)(core->sound_vol * 32000.0f);
-		ofs.write((const char*)&x, 2);
-		if (dataBytes != nullptr)
-		{
-			ofs.write(dataBytes, dataSize);
-		}
-		return true;
+		const float* p = (const float*)&paramData;
+		for (int i = 0; i < 32; i++)
+			wordTable[i] = sfxrToWord(p[i]);
+		x = sfxrToWord(core->sound_vol);
+		memcpy(dst, "SW", 2);
+		memcpy(dst + 2, &version, 2);
+		memcpy(dst + 4, &sz16, 2);
+		memcpy(dst + 6, wordTable, sizeof(wordTable));
+		memcpy(dst + 70, &x, 2);
+		head = 72;
 	}
 	else
 	{
-		char head[4] = { 'S', 'F', '0', '0' };
-		unsigned int sz = writeSize();
 		float version = 1.0f;
-		ofs.write(head, 2);
-		ofs.write((const char*)&version, 4);
-		ofs.write((const char*)&sz, 4);
-		ofs.write((const char*)&paramData, sizeof(paramData));
-		ofs.write((const char*)&(core->sound_vol),4);
-		if (dataBytes != nullptr)
-		{
-			ofs.write(dataBytes, dataSize);
-		}
-		return true;
+		memcpy(dst, "SF00", 4);
+		memcpy(dst + 4, &version, 4);
+		memcpy(dst + 8, &sz, 4);
+		memcpy(dst + 12, &paramData, sizeof(paramData));
+		memcpy(dst + 140, &(core->sound_vol), 4);
+		head = 144;
+	}
+	if (dataBytes != nullptr) memcpy(dst + head, dataBytes, dataSize);
+	return true;
+}
+
+bool Sfxr::loadStream(istream& ifs)
+{
+	// the fixed start of the record says how long it is, then the whole record is parsed from memory
+	char head[12];
+	unsigned int fixed = (mode & SFXR_WORD_MODE) ? 6 : 12, sz;
+	if (!ifs.read(head, fixed)) return false;
+	if (mode & SFXR_WORD_MODE)
+	{
+		uint16_t sz16;
+		memcpy(&sz16, head + 4, 2);
+		sz = sz16;
 	}
+	else memcpy(&sz, head + 8, 4);
+	if (sz < fixed || sz > 4194304) return false;
+	vector<char> record(sz);
+	memcpy(record.data(), head, fixed);
+	if (!ifs.read(record.data() + fixed, sz - fixed)) return false;
+	return loadBuffer(record.data(), sz);
+}
+
+bool Sfxr::loadFile(const char* fname)
+{
+	ifstream ifs(fname, ios::binary);
+	return loadStream(ifs);
+}
+
+bool Sfxr::writeStream(ostream& ofs)
+{
+	vector<char> record(writeSize());
+	writeBuffer(record.data(), record.size());
+	ofs.write(record.data(), record.size());
+	return ofs.good();
 }
 
 bool Sfxr::writeFile(const char* fname)
@@ -1233,10 +2727,14 @@ bool Sfxr::exportBuffer(ExportFormat method, void* pData)
 		break;
 	case ExportFormat::PCM8:
 		setPCM(SFXR_SAMPLERATE_INVALID, 8);
+		assertCreated();
+		if (pending && !(mode & SFXR_NORMALIZE)) return exportDirect((char*)pData);
 		return exportPCM((char*)pData);
 		break;
 	case ExportFormat::PCM16:
 		setPCM(SFXR_SAMPLERATE_INVALID, 16);
+		assertCreated();
+		if (pending && !(mode & SFXR_NORMALIZE)) return exportDirect((char*)pData);
 		return exportPCM((char*)pData);
 		break;
 	case ExportFormat::PCM24:
@@ -1288,6 +2786,18 @@ bool Sfxr::exportStream(ExportFormat method, std::ostream& ofs)
 	return false;
 }
 
+const float* Sfxr::getSamples()
+{
+	assertSynthed();
+	return core->buffer->data;
+}
+
+unsigned int Sfxr::sampleCount()
+{
+	assertSynthed();
+	return core->buffer->size();
+}
+
 bool Sfxr::exportWaveFloatStream(std::ostream& ofs, bool check_status)
 {
 	// create sample data, if we need to check
@@ -1344,7 +2854,7 @@ bool Sfxr::exportFloatStream(std::ostream& ofs, bool check_status)
 	if (check_status)
 		assertSynthed();
 
-	core->buffer->writeStream(ofs);
+	core->buffer->writeStream(ofs, outputGain());
 	return true;
 }
 
@@ -1355,19 +2865,22 @@ bool Sfxr::exportPCMStream(std::ostream& ofs, bool check_status)
 		assertSynthed();
 
 	// now the PCM data
+	float gain = outputGain();
+	SfxrDither dither;
+	SfxrDither* pDither = (mode & SFXR_DITHER) ? &dither : nullptr;
 	switch (sampleBytes)
 	{
 	case 1:
-		core->buffer->writeStream8(ofs);
+		core->buffer->writeStream8(ofs, gain, pDither);
 		break;
 	case 2:
-		core->buffer->writeStream16(ofs);
+		core->buffer->writeStream16(ofs, gain, pDither);
 		break;
 	case 3:
-		core->buffer->writeStream24(ofs);
+		core->buffer->writeStream24(ofs, gain);
 		break;
 	case 4:
-		core->buffer->writeStream32(ofs);
+		core->buffer->writeStream32(ofs, gain);
 		break;
 	default:
 		throw new runtime_error("bad size for sampleBytes in Sfxr::exportWaveStream()");
@@ -1387,14 +2900,6 @@ bool Sfxr::exportWaveFloatFile(const char* fname)
 	return exportWaveFloatStream(ofs);
 }
 
-struct sxfrInputBuffer : public std::streambuf
-{
-	sxfrInputBuffer(const char* s, std::size_t n)
-	{
-		setg((char*)s, (char*)s, (char*)s + n);
-	}
-};
-
 struct sxfrOutputBuffer : public std::streambuf
 {
 	sxfrOutputBuffer(const char* s, std::size_t n)
@@ -1405,39 +2910,22 @@ struct sxfrOutputBuffer : public std::streambuf
 
 bool Sfxr::loadString(const char* data)
 {
+	// no length given, so the record's own is trusted
+	unsigned int sz;
+	if (data == nullptr || data[0] != 'S') return false;
 	if (mode & SFXR_WORD_MODE)
 	{
-		size_t dataSize = sizeof(data);
-		if (dataSize < 34 * sizeof(uint16_t)) return false;
-		sxfrInputBuffer osrb(data, dataSize);
-		std::istream istr(&osrb);
-		return loadStream(istr);
+		uint16_t sz16;
+		memcpy(&sz16, data + 4, 2);
+		sz = sz16;
 	}
-	else
-	{
-		size_t dataSize = sizeof(data);
-		if (dataSize < 2 * sizeof(float) + sizeof(paramData)) return false;
-		sxfrInputBuffer osrb(data, dataSize);
-		std::istream istr(&osrb);
-		return loadStream(istr);
-	}
-
+	else memcpy(&sz, data + 8, 4);
+	return loadBuffer(data, sz);
 }
 
 bool Sfxr::writeString(char* data)
 {
-	if (mode & SFXR_WORD_MODE)
-	{
-		sxfrOutputBuffer osrb(data, 34 * sizeof(uint16_t));
-		std::ostream ostr(&osrb);
-		return writeStream(ostr);
-	}
-	else
-	{
-		sxfrOutputBuffer osrb(data, 2 * sizeof(float) + sizeof(paramData));
-		std::ostream ostr(&osrb);
-		return writeStream(ostr);
-	}
+	return writeBuffer(data, writeSize());
 }
 
 bool Sfxr::exportWaveFloatString(char* data)
@@ -1482,6 +2970,13 @@ void Sfxr::create(const char* what)
 }
 
 void Sfxr::create(int what)
+{
+	preset(what);
+	// actually work the magic!
+	create();
+}
+
+void Sfxr::preset(int what)
 {
 	// a clean slate!
 	reset();
@@ -1640,8 +3135,49 @@ void Sfxr::create(int what)
 		// if we pass a bad option, just randomize it all
 		randomize();
 	}
-	// actually work the magic!
-	create();
+}
+
+size_t Sfxr::createBatch(int what, const unsigned long long* seeds, unsigned int count, ExportFormat method, void* out, size_t* offsets, unsigned int threads)
+{
+	// every variant's parameters first, each from its seed on our PCG32 (put back after), so all the sizes are known up front
+	vector<Parameters> params(count);
+	vector<size_t> offs(count + 1);
+	PCG32 saved = core->pcg;
+	Parameters keep = paramData;
+	offs[0] = 0;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		core->seed(seeds[i]);
+		preset(what);
+		params[i] = paramData;
+		offs[i + 1] = offs[i] + predictSize(method, params[i]);
+	}
+	core->pcg = saved;
+	paramData = keep;
+	if (offsets != nullptr) memcpy(offsets, offs.data(), sizeof(size_t) * (count + 1));
+	if (out == nullptr || count == 0) return offs[count];
+
+	// then rendered, each thread reusing one Sfxr set up as this one is, straight into its place in out
+	atomic<unsigned int> next{ 0 };
+	auto work = [&]() {
+		Sfxr worker(getSampleRate(), getBitDepth());
+		if (format == ExportFormat::FLOAT) worker.setFloat();
+		worker.setMode(mode);
+		worker.setVolume(getVolume());
+		for (unsigned int i = next++; i < count; i = next++)
+		{
+			worker.setParameters(params[i]);
+			worker.create();
+			worker.exportBuffer(method, (char*)out + offs[i]);
+		}
+	};
+	if (threads > count) threads = count;
+	vector<thread> helpers;
+	for (unsigned int t = 1; t < threads; t++)
+		helpers.emplace_back(work);
+	work();
+	for (thread& t : helpers) t.join();
+	return offs[count];
 }
 
 void Sfxr::create()
@@ -1652,15 +3188,78 @@ void Sfxr::create()
 	// if we are in word more, lock params to work values
 	if (mode & SFXR_WORD_MODE) lockWordParams();
 
+	core->buffer->clear();
+	if (mode & SFXR_DIRECT_PCM)
+	{
+		// just count the samples, a PCM8/PCM16 exportBuffer() synths them straight into its destination
+		totalSamples = core->measure();
+		pending = true;
+	}
+	else
+		render();
+
+	created = true;
+	rebuild = false;
+}
+
+void Sfxr::render()
+{
 	core->resetSample(false);
 	core->playing_sample = true;
 	core->buffer->clear();
+	core->buffer->reserve(core->lengthHint());
 	while (core->playing_sample)
 		core->synthSample();
 
 	totalSamples = core->buffer->size();
-	created = true;
-	rebuild = false;
+	pending = false;
+}
+
+bool Sfxr::exportDirect(char* data)
+{
+	// synth a piece at a time into a small block that stays in cache, and quantize it right into data
+	float block[SFXR_BUFFER_CHUNK / 4];
+	unsigned int done = 0;
+	SfxrDither dither;
+	SfxrDither* pDither = (mode & SFXR_DITHER) ? &dither : nullptr;
+	core->resetSample(false);
+	core->playing_sample = true;
+	while (core->playing_sample && done < totalSamples)
+	{
+		unsigned int n = core->synthSample(block, min(totalSamples - done, (unsigned int)(SFXR_BUFFER_CHUNK / 4)));
+		float bound = isfinite(core->block_squares) ? core->block_peak : INFINITY;
+		if (sampleBytes == 1)
+			sfxrToPCM8(block, (uint8_t*)data + done, n, 1.0f, pDither, bound);
+		else
+			sfxrToPCM16(block, (int16_t*)data + done, n, 1.0f, pDither, bound);
+		done += n;
+	}
+	return done == totalSamples;
+}
+
+void Sfxr::beginStream()
+{
+	// if we are in word more, lock params to work values
+	if (mode & SFXR_WORD_MODE) lockWordParams();
+
+	core->resetSample(false);
+	core->playing_sample = true;
+}
+
+size_t Sfxr::renderInto(float* dst, size_t n)
+{
+	size_t done = 0;
+	while (done < n && core->playing_sample)
+	{
+		unsigned int chunk = (n - done > 4096) ? 4096 : (unsigned int)(n - done);
+		done += core->synthSample(dst + done, chunk);
+	}
+	return done;
+}
+
+bool Sfxr::isFinished()
+{
+	return !core->playing_sample;
 }
 
 #define GPI(opt) if (!strcmp(pname,SFXRS_ ## opt)) return SFXRI_ ## opt
@@ -1714,42 +3313,81 @@ float& Sfxr::operator[](const char *p)
 void Sfxr::getInfo(SoundInfo& info) { getInfo(&info); }
 void Sfxr::getInfo(SoundInfo* info)
 {
+	// the limit and average need the samples, even when only measured
+	if (pending) render();
 	info->format = this->format;
 	info->totalBytes = core->buffer->sizeBytes();
 	info->totalSamples = core->buffer->size();
 	info->duration = (float)info->totalSamples / (float)core->out_freq;
 	info->memoryUsed = core->buffer->memoryBytes();
 	info->overhead = (float)info->memoryUsed / (float)info->totalBytes;
+	// kept up during synthesis, so no pass over the samples here, and scaled to match what an export gives
+	float gain = outputGain();
 	core->buffer->getLimitAverage(&(info->limit), &(info->average));
+	info->limit *= gain;
+	info->average *= gain;
+	info->rms = core->buffer->getRMS() * gain;
 }
 // these are much quicker! and don't return all the extra info
 void Sfxr::getInfo(SoundQuickInfo& info) { getInfo(&info);  }
 void Sfxr::getInfo(SoundQuickInfo* info)
 {
 	info->format = this->format;
-	info->totalBytes = core->buffer->sizeBytes();
-	info->totalSamples = core->buffer->size();
+	info->totalBytes = totalSamples * (unsigned int)sizeof(float);
+	info->totalSamples = totalSamples;
 	info->duration = (float)info->totalSamples / (float)core->out_freq;
 }
 
-void Sfxr::normalize()
+float Sfxr::outputGain()
 {
-	SoundInfo si;
-
-	getInfo(si);
-	core->buffer->scale(1.0f / si.limit);
+	// SFXR_NORMALIZE is folded into the conversion on export, the samples themselves stay as synthed
+	if (!(mode & SFXR_NORMALIZE) || core->buffer->peak <= 0.0f) return 1.0f;
+	return 1.0f / core->buffer->peak;
 }
 
 void Sfxr::lockWordParams()
 {
-	float* param = (float*)&paramData;
-	int index = 0;
-	for (int i = 0; i < 8; i++)
-	{
-		int index = i * 4;
-		param[index] = (float)trunc((int)param[index] * 32000);
-		param[index+1] = (float)trunc((int)param[index+1] * 32000);
-		param[index+2] = (float)trunc((int)param[index+2] * 32000);
-		param[index+3] = (float)trunc((int)param[index+3] * 32000);
-	}
+	lockWordParams(paramData);
+}
+
+void Sfxr::lockWordParams(Parameters& p)
+{
+	// to what an SW record holds, so a word mode sound is the same after a write and load
+	float* param = (float*)&p;
+	for (int i = 0; i < 32; i++)
+		param[i] = sfxrFromWord(sfxrToWord(param[i]));
+}
+
+// *************************************************************************************
+// SfxrBatch, see SfxrBatchCore for the lane layout
+SfxrBatch::SfxrBatch()
+{
+	core = new SfxrBatchCore();
+}
+
+SfxrBatch::~SfxrBatch()
+{
+	delete core;
+}
+
+void SfxrBatch::render(const Sfxr::Parameters* params, unsigned int count, const float* sound_vol)
+{
+	core->render(params, count, sound_vol);
+}
+
+unsigned int SfxrBatch::count()
+{
+	return (unsigned int)core->outputs.size();
+}
+
+unsigned int SfxrBatch::size(unsigned int i)
+{
+	if (i >= core->outputs.size()) throw new runtime_error("invalid index into SfxrBatch::size()");
+	return (unsigned int)core->outputs[i].size();
+}
+
+const float* SfxrBatch::getSamples(unsigned int i)
+{
+	if (i >= core->outputs.size()) throw new runtime_error("invalid index into SfxrBatch::getSamples()");
+	return core->outputs[i].data();
 }
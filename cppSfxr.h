@@ -19,6 +19,10 @@
 // comment options here to configure at compile time, if you are using one instace of Sfxr, or allocating it on the heap, leave these in
 #define SFXR_STATIC_STREAM_BUFFER		// use a static 16kb buffer for generating streams (per instance of Sfxr)
 #define SFXR_DISALLOW_SAMPLERATE		// don't allow a sample rate change (undef to play around)
+#define SFXR_BATCH_LANES			8	// sounds per pass of SfxrBatch: 8 fills AVX2 (build with -mavx2), 4 fills SSE/NEON
+#define SFXR_POOL_LIMIT			(1 << 20)	// bytes of freed sample memory each thread starts out keeping for reuse, 0 is off (see Sfxr::setPoolLimit)
+#define SFXR_NOISE_BLOCKS		4096		// 32 value blocks of white and pink noise made once and shared by all renders (512KB each)
+#define SFXR_CONTROL_SAMPLES	32			// samples between control points in mode SFXR_CONTROL_RATE
 
 #include <iostream>
 
@@ -104,6 +108,10 @@
 #define SFXR_PLAIN_MODE			0
 #define SFXR_NORMALIZE			1	// normalize the output so limit is always 1.0f
 #define SFXR_WORD_MODE			2	// use word size params, 16 bit fixed point: -32.000 to 32.000
+#define SFXR_FAST_MATH			4	// use fast approximations of sin, tan and pow in the synth, close to but not bit exact (bounds in cppSfxr.cpp)
+#define SFXR_DIRECT_PCM			8	// create() only measures, PCM8/PCM16 exportBuffer() synths straight into your buffer (again each time)
+#define SFXR_DITHER				16	// TPDF dither PCM8/PCM16 exports and round them to nearest (same dither every export, so still repeatable)
+#define SFXR_CONTROL_RATE		32	// SFXR_FAST_MATH, plus vibrato, filter sweeps and envelope interpolated between control points (same length)
 
 
 // hide a lot of the internal stuff to make this nice and clean
@@ -155,6 +163,7 @@ public:
 		float limit;				// largest sample
 		float average;				// average sample
 		ExportFormat format;		// current selected export format (or ExportFormat::FLOAT if none has been set)
+		float rms;					// root mean square of the samples
 	};
 
 	struct SoundQuickInfo
@@ -168,6 +177,9 @@ public:
 	const char* from[7] = { "PICKUP/COIN", "LASER/SHOOT", "EXPLOSION", "POWERUP", "HIT/HURT", "JUMP", "BLIP/SELECT" };
 
 	Sfxr(unsigned int sample_rate = 44100, unsigned int bit_depth = 16);
+	~Sfxr();
+	Sfxr(const Sfxr&) = delete;				// owns its core, copy the Parameters instead
+	Sfxr& operator=(const Sfxr&) = delete;
 
 	void reset();
 	// all of these function use PCG32, so you might want to seed it to make the exact same sounds if that is a use case?
@@ -175,11 +187,24 @@ public:
 	void randomize();
 	void create(const char* what);
 	void create(int what);
+	// count variants of a kind at once, variant i is what seed(seeds[i]) then create(what) here would make, exported back to back:
+	// returns the bytes they take, and offsets (if given, count + 1 of them) gets where each starts, so call first with out
+	// as nullptr to size it, then again to fill it, over threads if more than 1 (this Sfxr's sound and PCG32 are left as they were)
+	size_t createBatch(int what, const unsigned long long* seeds, unsigned int count, ExportFormat method, void* out, size_t* offsets = nullptr, unsigned int threads = 1);
 	// seed functions
 	void seed(unsigned long long s);
 	void seed(const char* s);	// must be 4 bytes at least or even better 8 bytes!
+	// or keyed: the draws after it depend only on (s, index, purpose), so e.g. sound index of a set made from seed s is
+	// the same whatever was made before it, or in what order or on what thread (purpose keeps other uses apart)
+	void seed(unsigned long long s, unsigned long long index, unsigned int purpose = 0);
 	// synth the sound!
 	void create();
+	// or stream it: synth the current parameters a piece at a time into your own buffer, nothing is kept
+	// renderInto() returns the samples written, less than n only once the sound has ended
+	// (SFXR_NORMALIZE does not apply, and create(), including one run by an export, ends the stream)
+	void beginStream();
+	size_t renderInto(float* dst, size_t n);
+	bool isFinished();
 	// set Parameters
 	void setParameters(Parameters& p);
 	void setParameters(Parameters* p);
@@ -188,8 +213,11 @@ public:
 	// these all are methods to read and save the parameter data
 	bool loadFile(const char* fname);
 	bool writeFile(const char* fname);
-	bool loadString(const char* data);
-	bool writeString(char* data);
+	bool loadString(const char* data);	// trusts the length in the record, use loadBuffer() when you know the size
+	bool writeString(char* data);		// writeSize() bytes
+	// straight from/to memory, no streams: with copy false attached data is used in place, so keep the buffer while it's set
+	bool loadBuffer(const void* data, size_t size, bool copy = true);
+	bool writeBuffer(void* data, size_t size);
 	bool loadStream(std::istream& ifs);
 	bool writeStream(std::ostream& ofs);
 	unsigned int writeSize();
@@ -197,21 +225,31 @@ public:
 	bool exportBuffer(ExportFormat method, void* pData);	// output to a buffer, use the size() call to know how large to make it
 	bool exportStream(ExportFormat method, std::ostream& ofs);
 															// output to a std stream
+	// or read the float samples in place, one contiguous run valid until the next create() or change of parameters
+	const float* getSamples();
+	unsigned int sampleCount();
 	// write .wav files, if you are into that kind of thing
 	bool exportWaveFile(const char* fname);
 	bool exportWaveFloatFile(const char* fname);
 
 	// get the output total size
 	unsigned int size(ExportFormat method);
+	// or know it before any synthing: the exact sample count (and size) create() would make of p with this Sfxr's
+	// mode and sample rate, worked out from the envelope and the freq_limit cutoff, cheap enough to call per sound
+	unsigned int predictLength(const Parameters& p);
+	unsigned int predictSize(ExportFormat method, const Parameters& p);
 	// this will someday work right, as of right now changing the sample_rate alters the output quite a bit
 	void setPCM(unsigned int sample_rate = 44100, unsigned int bit_depth = 16);
 	// using float format
 	void setFloat();
+	// what setPCM()/setFloat() left set
+	unsigned int getSampleRate();
+	unsigned int getBitDepth();
 	// set operating mode options (see options above, all bit flagged)
 	void setMode(unsigned int m);
 	// get operating mode options
 	unsigned int getMode();
-	// these are non-trivial because we scan the output for limit and average samples, FYI
+	// these gather limit, average and rms while synthing, so they are quick too (SFXR_DIRECT_PCM has to synth first)
 	void getInfo(SoundInfo& info);
 	void getInfo(SoundInfo* info);
 	// these are much quicker! and don't return all the extra info
@@ -225,6 +263,14 @@ public:
 	void* getData();
 	// get the size of the data attached to this sound
 	unsigned int getDataSize();
+	// the sound's volume (0.5f by default), kept with the parameters in SF/SW streams and sound banks
+	void setVolume(float v);
+	float getVolume();
+	// sample memory freed by any Sfxr is pooled per thread for the next one: bytes held, cap on that, and give it back
+	// these only touch the calling thread's pool, every other thread (createBatch's, libSfxr's and lazyBank's workers too) keeps its own at SFXR_POOL_LIMIT
+	static size_t poolBytes();
+	static void setPoolLimit(size_t bytes);	// 0 turns pooling off
+	static void trimPool(size_t keep = 0);
 	// get/set the parameter at an index, like so: wave_type = mySfxr[SFXRI_WAVE_TYPE]; or mySfxr[SFXRI_WAVE_TYPE] = 2;
 	float& operator[](unsigned int i);
 	// get/set the parameter at an index, like so: wave_type = mySfxr["WAVE TYPE"]; or mySfxr["WAVE_TYPE"] = 2;
@@ -240,13 +286,20 @@ private:
 	unsigned int sampleBytes = 2;
 	ExportFormat format = ExportFormat::FLOAT;
 	unsigned int mode = SFXR_PLAIN_MODE;
+	bool pending = false;		// measured but not rendered, see SFXR_DIRECT_PCM
 	unsigned int dataSize = 0;
 	char* dataBytes = nullptr;
 	bool dataCopied = false;
 
-	void normalize();
+	float outputGain();
+	void preset(int what);		// create(what)'s parameters, without the synth
 	void lockWordParams();
+	void lockWordParams(Parameters& p);
+	unsigned int sizeFor(ExportFormat method, unsigned int samples);
 	void assertSynthed();
+	void assertCreated();
+	void render();
+	bool exportDirect(char* data);
 	unsigned int sizeWaveString();
 	unsigned int sizeWaveFloatString();
 	bool exportWaveString(char* data);
@@ -258,3 +311,23 @@ private:
 	bool exportPCMStream(std::ostream& ofs, bool check_status = true);
 	bool exportFloatStream(std::ostream& ofs, bool check_status = true);
 };
+
+// render many sounds at once, SFXR_BATCH_LANES at a time, each pass running the synth stages for all its sounds together
+class SfxrBatchCore;
+
+class SfxrBatch {
+public:
+	SfxrBatch();
+	~SfxrBatch();
+
+	// render count sounds, sound_vol is per sound (or nullptr for the 0.5f default), output matches Sfxr::create() on a new Sfxr
+	void render(const Sfxr::Parameters* params, unsigned int count, const float* sound_vol = nullptr);
+	// how many sounds the last render() made
+	unsigned int count();
+	// the float samples of a sound from the last render()
+	unsigned int size(unsigned int i);
+	const float* getSamples(unsigned int i);
+
+private:
+	SfxrBatchCore* core;
+};
@@ -1,4 +1,6 @@
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -99,6 +101,10 @@ extern "C" {
 #define SFXR_PLAIN_MODE			0
 #define SFXR_NORMALIZE			1
 #define SFXR_WORD_MODE			2
+#define SFXR_FAST_MATH			4
+#define SFXR_DIRECT_PCM			8	// create only measures, PCM8/PCM16 cs_export_buffer synths straight into pData
+#define SFXR_DITHER				16	// TPDF dither PCM8/PCM16 exports
+#define SFXR_CONTROL_RATE		32	// SFXR_FAST_MATH plus modulation interpolated between control points, same length
 
 struct csParameters {
   float wave_type = 0.0f;
@@ -141,6 +147,7 @@ struct csSoundInfo
   float limit;				// largest sample
   float average;				// average sample
   unsigned int format;		// current selected export format (or ExportFormat::FLOAT if none has been set)
+  float rms;					// root mean square of the samples
 };
 
 struct csSoundQuickInfo
@@ -181,10 +188,10 @@ struct csSfxr {
   // using float format
   void (*set_float)(void *p);
   // set operating mode options (see options above, all bit flagged)
-  void (*set_mode)(unsigned int m);
+  void (*set_mode)(void *p, unsigned int m);
   // get operating mode options
-  unsigned int (*get_mode)();
-  // this is non-trivial because we scan the output for limit and average samples, FYI
+  unsigned int (*get_mode)(void *p);
+  // limit, average and rms are gathered while synthing, so this is quick too
   void (*get_info)(void *p, csSoundInfo* info);
   // this is much quicker! and don't return all the extra info
   void (*get_infoq)(void *p, csSoundQuickInfo* info);
@@ -192,6 +199,19 @@ struct csSfxr {
   int (*get_paramindex)(void *p, const char* pname);
   float (*get_param)(void *p, int index);
   void (*set_param)(void *p, int index, float f);
+  // stream the current parameters into your own float buffer, a piece at a time
+  void (*begin_stream)(void *p);
+  unsigned int (*render_into)(void *p, float* dst, unsigned int n);
+  bool (*is_finished)(void *p);
+  // the exact sample count create would make of x, without synthing anything
+  unsigned int (*predict_length)(void *p, csParameters* x);
+  // parameter records straight from/to memory, size is checked (copy false keeps using data's attached bytes in place)
+  bool (*load_buffer)(void *p, const void* data, unsigned int size, bool copy);
+  bool (*write_buffer)(void *p, void* data, unsigned int size);
+  // count variants of a kind packed into out, pass out as NULL first for the size (offsets gets count + 1 entries)
+  size_t (*create_batch)(void *p, int what, const unsigned long long* seeds, unsigned int count, unsigned int method, void* out, size_t* offsets, unsigned int threads);
+  // the draws after it depend only on (s, index, purpose)
+  void (*seed_keyed)(void *p, unsigned long long s, unsigned long long index, unsigned int purpose);
 };
 
 DLLAPI void cs_get(csSfxr* p);
@@ -199,6 +219,7 @@ DLLAPI void* cs_new();
 DLLAPI void cs_delete(void *p);
 DLLAPI void cs_seed_uint(void* p, unsigned long long s);
 DLLAPI void cs_seed_str(void* p, const char* s);	// must be 4 bytes at least or even better 8 bytes!
+DLLAPI void cs_seed_keyed(void* p, unsigned long long s, unsigned long long index, unsigned int purpose);
 DLLAPI void cs_reset(void *p);
 DLLAPI void cs_mutate(void *p);
 DLLAPI void cs_randomize(void *p);
@@ -212,6 +233,9 @@ DLLAPI bool cs_load_file(void *p, const char* fname);
 DLLAPI bool cs_write_file(void *p, const char* fname);
 DLLAPI bool cs_load_string(void *p, const char* data);
 DLLAPI bool cs_write_string(void *p, char* data);
+DLLAPI bool cs_load_buffer(void *p, const void* data, unsigned int size, bool copy);
+DLLAPI bool cs_write_buffer(void *p, void* data, unsigned int size);
+DLLAPI size_t cs_create_batch(void *p, int what, const unsigned long long* seeds, unsigned int count, unsigned int method, void* out, size_t* offsets, unsigned int threads);
 // this is the method to get the actual output
 DLLAPI bool cs_export_buffer(void *p, unsigned int method, void* pData);	// output to a buffer, use the size() call to know how large to make it
 // write .wav files, if you are into that kind of thing
@@ -219,6 +243,8 @@ DLLAPI bool cs_export_wavefile(void *p, const char* fname);
 DLLAPI bool cs_export_wavefloatfile(void *p, const char* fname);
 // get the output total size
 DLLAPI unsigned int cs_size(void *p, unsigned int method);
+// the exact sample count cs_create would make of x, without synthing anything
+DLLAPI unsigned int cs_predict_length(void *p, csParameters* x);
 // this will someday work right, as of right now changing the sample_rate alters the output quite a bit
 DLLAPI void cs_set_PCM(void *p, unsigned int sample_rate, unsigned int bit_depth);
 // using float format
@@ -227,7 +253,7 @@ DLLAPI void cs_set_float(void *p);
 DLLAPI void cs_set_mode(void *p, unsigned int m);
 // get operating mode options
 DLLAPI unsigned int cs_get_mode(void *p);
-// this is non-trivial because we scan the output for limit and average samples, FYI
+// limit, average and rms are gathered while synthing, so this is quick too
 DLLAPI void cs_get_info(void *p, csSoundInfo* info);
 // this is much quicker! and don't return all the extra info
 DLLAPI void cs_get_infoq(void *p, csSoundQuickInfo* info);
@@ -235,6 +261,10 @@ DLLAPI void cs_get_infoq(void *p, csSoundQuickInfo* info);
 DLLAPI int cs_get_paramindex(void *p, const char* pname);
 DLLAPI float cs_get_param(void *p, int index);
 DLLAPI void cs_set_param(void *p, int index, float f);
+// stream the current parameters into your own float buffer, a piece at a time
+DLLAPI void cs_begin_stream(void *p);
+DLLAPI unsigned int cs_render_into(void *p, float* dst, unsigned int n);	// returns samples written, less than n only once the sound has ended
+DLLAPI bool cs_is_finished(void *p);
 
 #ifdef __cplusplus
 }
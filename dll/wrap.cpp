@@ -58,6 +58,7 @@ extern "C" {
         float limit;				// largest sample
         float average;				// average sample
         unsigned int format;		// current selected export format (or ExportFormat::FLOAT if none has been set)
+        float rms;					// root mean square of the samples
     };
 
     struct csSoundQuickInfo
@@ -101,7 +102,7 @@ extern "C" {
         void (*set_mode)(void *p, unsigned int m);
         // get operating mode options
         unsigned int (*get_mode)(void* p);
-        // this is non-trivial because we scan the output for limit and average samples, FYI
+        // limit, average and rms are gathered while synthing, so this is quick too
         void (*get_info)(void* p, csSoundInfo* info);
         // this is much quicker! and don't return all the extra info
         void (*get_infoq)(void* p, csSoundQuickInfo* info);
@@ -109,6 +110,19 @@ extern "C" {
         int (*get_paramindex)(void* p, const char* pname);
         float (*get_param)(void* p, int index);
         void (*set_param)(void* p, int index, float f);
+        // stream the current parameters into your own float buffer, a piece at a time
+        void (*begin_stream)(void* p);
+        unsigned int (*render_into)(void* p, float* dst, unsigned int n);
+        bool (*is_finished)(void* p);
+        // the exact sample count cs_create would make of x, without synthing anything
+        unsigned int (*predict_length)(void* p, csParameters* x);
+        // parameter records straight from/to memory, size is checked (copy false keeps using data's attached bytes in place)
+        bool (*load_buffer)(void* p, const void* data, unsigned int size, bool copy);
+        bool (*write_buffer)(void* p, void* data, unsigned int size);
+        // count variants of a kind packed into out, pass out as NULL first for the size (offsets gets count + 1 entries)
+        size_t (*create_batch)(void* p, int what, const unsigned long long* seeds, unsigned int count, unsigned int method, void* out, size_t* offsets, unsigned int threads);
+        // the draws after it depend only on (s, index, purpose)
+        void (*seed_keyed)(void* p, unsigned long long s, unsigned long long index, unsigned int purpose);
     };
 
 
@@ -180,6 +194,16 @@ extern "C" {
         return CP->writeString(data);
     }
 
+    DLLAPI bool cs_load_buffer(void* p, const void* data, unsigned int size, bool copy)
+    {
+        return CP->loadBuffer(data, size, copy);
+    }
+
+    DLLAPI bool cs_write_buffer(void* p, void* data, unsigned int size)
+    {
+        return CP->writeBuffer(data, size);
+    }
+
     // this is the method to get the actual output
     DLLAPI bool cs_export_buffer(void* p, unsigned int method, void* pData)	// output to a buffer, use the size() call to know how large to make it
     {
@@ -198,6 +222,23 @@ extern "C" {
         return CP->exportBuffer(f, pData);
     }
 
+    DLLAPI size_t cs_create_batch(void* p, int what, const unsigned long long* seeds, unsigned int count, unsigned int method, void* out, size_t* offsets, unsigned int threads)
+    {
+        Sfxr::ExportFormat f;
+        switch (method)
+        {
+        case SFXR_FORMAT_WAVE_PCM: f = Sfxr::ExportFormat::WAVE_PCM; break;
+        case SFXR_FORMAT_WAVE_FLOAT: f = Sfxr::ExportFormat::WAVE_FLOAT; break;
+        case SFXR_FORMAT_PCM8: f = Sfxr::ExportFormat::PCM8; break;
+        case SFXR_FORMAT_PCM16: f = Sfxr::ExportFormat::PCM16; break;
+        case SFXR_FORMAT_PCM24: f = Sfxr::ExportFormat::PCM24; break;
+        case SFXR_FORMAT_PCM32: f = Sfxr::ExportFormat::PCM32; break;
+        case SFXR_FORMAT_FLOAT: f = Sfxr::ExportFormat::FLOAT; break;
+        default: return 0;
+        }
+        return CP->createBatch(what, seeds, count, f, out, offsets, threads);
+    }
+
     // write .wav files, if you are into that kind of thing
     DLLAPI bool cs_export_wavefile(void* p, const char* fname)
     {
@@ -227,6 +268,12 @@ extern "C" {
         return CP->size(f);
     }
 
+    // the exact sample count cs_create would make of x, without synthing anything
+    DLLAPI unsigned int cs_predict_length(void* p, csParameters* x)
+    {
+        return CP->predictLength(*(Sfxr::Parameters*)x);
+    }
+
     // this will someday work right, as of right now changing the sample_rate alters the output quite a bit
     DLLAPI void cs_set_PCM(void* p, unsigned int sample_rate, unsigned int bit_depth)
     {
@@ -251,7 +298,7 @@ extern "C" {
       return CP->getMode();
     }
 
-    // this is non-trivial because we scan the output for limit and average samples, FYI
+    // limit, average and rms are gathered while synthing, so this is quick too
     DLLAPI void cs_get_info(void* p, csSoundInfo* info)
     {
         CP->getInfo((Sfxr::SoundInfo*)info);
@@ -289,11 +336,33 @@ extern "C" {
         CP->seed(s);
     }
 
+    DLLAPI void cs_seed_keyed(void* p, unsigned long long s, unsigned long long index, unsigned int purpose)
+    {
+        CP->seed(s, index, purpose);
+    }
+
     DLLAPI csParameters* cs_get_parameters(void* p)
     {
         return (csParameters*)CP->getParameters();
     }
 
+    // stream the current parameters into your own float buffer, a piece at a time
+    DLLAPI void cs_begin_stream(void* p)
+    {
+        CP->beginStream();
+    }
+
+    // returns samples written, less than n only once the sound has ended
+    DLLAPI unsigned int cs_render_into(void* p, float* dst, unsigned int n)
+    {
+        return (unsigned int)CP->renderInto(dst, n);
+    }
+
+    DLLAPI bool cs_is_finished(void* p)
+    {
+        return CP->isFinished();
+    }
+
     DLLAPI void cs_get(csSfxr* p)
     {
         p->_new = cs_new;
@@ -325,7 +394,7 @@ extern "C" {
         p->set_mode = cs_set_mode;
         // get operating mode options
         p->get_mode = cs_get_mode;
-        // this is non-trivial because we scan the output for limit and average samples, FYI
+        // limit, average and rms are gathered while synthing, so this is quick too
         p->get_info = cs_get_info;
         // this is much quicker! and don't return all the extra info
         p->get_infoq = cs_get_infoq;
@@ -337,6 +406,15 @@ extern "C" {
         p->seed_uint = cs_seed_uint;
         p->seed_str = cs_seed_str;
         p->get_parameters = cs_get_parameters;
+        // stream the current parameters into your own float buffer, a piece at a time
+        p->begin_stream = cs_begin_stream;
+        p->render_into = cs_render_into;
+        p->is_finished = cs_is_finished;
+        p->predict_length = cs_predict_length;
+        p->load_buffer = cs_load_buffer;
+        p->write_buffer = cs_write_buffer;
+        p->create_batch = cs_create_batch;
+        p->seed_keyed = cs_seed_keyed;
     }
 
 }
@@ -20,10 +20,23 @@
 #include <cstring>
 #include <memory.h>
 #include <stdlib.h>
+#include <fstream>
+#include <filesystem>
+#include <functional>
+#include <algorithm>
 
-using namespace std;
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
-unsigned int libSfxr_threadSfxr(void* p);
+using namespace std;
 
 // *******************************************************************************
 // some filter functions for imaging
@@ -173,115 +186,280 @@ libSfxr::threadSfxr::threadSfxr(unsigned int mode, Sfxr::ExportFormat _format)
 	eFormat = _format;
 }
 
-void libSfxr::threadSfxr::push(Sfxr::Parameters* p) { push(*p); }
-void libSfxr::threadSfxr::push(Sfxr::Parameters& p)
+libSfxr::threadSfxr::~threadSfxr()
+{
+	end();
+	for (sndParam* ps : buildList)
+	{
+		if (ps->strLen != 0) delete[] ps->pStr;
+		else delete ps->pParam;
+		delete ps;
+	}
+	for (sndOutput* pOut : outputList)
+	{
+		if (pOut == nullptr) continue;
+		if (!pOut->shared) delete[] pOut->pSample;
+		delete pOut->pInfo;
+		delete pOut;
+	}
+	job j;
+	while (jobs.pop(j))
+	{
+		if (j.param->strLen != 0) delete[] j.param->pStr;
+		else delete j.param->pParam;
+		delete j.param;
+	}
+	delete pSfxr;
+}
+
+unsigned int libSfxr::threadSfxr::push(Sfxr::Parameters* p) { return push(*p); }
+unsigned int libSfxr::threadSfxr::push(Sfxr::Parameters& p)
 {
-	mutexList.lock();
-	buildList.push_back(new sndParam(p));
-	mutexList.unlock();
+	sndParam* ps = new sndParam(p);
+	unsigned int ticket;
+	{
+		lock_guard<mutex> lock(mutexState);
+		ticket = (unsigned int)buildList.size();
+		buildList.push_back(ps);
+		outputList.push_back(nullptr);
+	}
+	wake.notify_one();
+	return ticket;
 }
 
-void libSfxr::threadSfxr::push(const char* str, unsigned int len)
+unsigned int libSfxr::threadSfxr::push(const char* str, unsigned int len)
 {
 	if (len == 0) len = (unsigned int)strlen(str);
 	char* buff = new char[len];
 	memcpy(buff, str, len);
-	mutexList.lock();
-	buildList.push_back(new sndParam(buff,len));
-	mutexList.unlock();
+	sndParam* ps = new sndParam(buff, len);
+	unsigned int ticket;
+	{
+		lock_guard<mutex> lock(mutexState);
+		ticket = (unsigned int)buildList.size();
+		buildList.push_back(ps);
+		outputList.push_back(nullptr);
+	}
+	wake.notify_one();
+	return ticket;
+}
+
+libSfxr::sndOutput* libSfxr::threadSfxr::getOutput(unsigned int ticket)
+{
+	lock_guard<mutex> lock(mutexState);
+	return ticket < outputList.size() ? outputList[ticket] : nullptr;
+}
+
+libSfxr::sndOutput* libSfxr::threadSfxr::waitOutput(unsigned int ticket)
+{
+	unique_lock<mutex> lock(mutexState);
+	built.wait(lock, [&]() { return ticket >= outputList.size() || outputList[ticket] != nullptr || !filling; });
+	return ticket < outputList.size() ? outputList[ticket] : nullptr;
 }
 
 void libSfxr::threadSfxr::begin()
 {
+	unique_lock<mutex> lock(mutexState);
 	if (filling) return;
-	mutexState.lock();
+	// a worker stopped by setFilling(false) has returned (or is about to) but was never joined
+	if (worker.joinable())
+	{
+		thread old = move(worker);
+		lock.unlock();
+		old.join();
+		lock.lock();
+		if (filling) return;
+	}
 	filling = true;
 	complete = false;
-	building = 0;
-	pThread = new thread(&libSfxr_threadSfxr,this);
-	mutexState.unlock();
+	if (building < 0) building = 0;
+	worker = thread(&threadSfxr::work, this);
 }
 
 void libSfxr::threadSfxr::end()
 {
-	mutexState.lock();
-	filling = false;
+	{
+		lock_guard<mutex> lock(mutexState);
+		filling = false;
+	}
+	wake.notify_all();
+	if (worker.joinable()) worker.join();
+	lock_guard<mutex> lock(mutexState);
 	complete = true;
-	mutexState.unlock();
-	// todo: cleanup thread here
+}
+
+void libSfxr::threadSfxr::wait()
+{
+	unique_lock<mutex> lock(mutexState);
+	built.wait(lock, [this]() { return !filling || building >= (int)buildList.size(); });
 }
 
 bool libSfxr::threadSfxr::isFilling()
 {
-	bool ret;
-	mutexState.lock();
-	ret = filling;
-	mutexState.unlock();
-	return ret;
+	return filling;
 }
 
 bool libSfxr::threadSfxr::isComplete()
 {
-	bool ret;
-	mutexState.lock();
-	ret = complete;
-	mutexState.unlock();
-	return ret;
+	return complete;
 }
 
 void libSfxr::threadSfxr::setComplete(bool s)
 {
-	mutexState.lock();
+	lock_guard<mutex> lock(mutexState);
 	complete = s;
-	mutexState.unlock();
 }
 
 int libSfxr::threadSfxr::getBuilding()
 {
-	int ret;
-	mutexState.lock();
-	ret = building;
-	mutexState.unlock();
-	return ret;
+	return building;
 }
 
 int libSfxr::threadSfxr::getBuildTotal()
 {
-	int ret;
-	mutexState.lock();
-	ret = buildList.size();
-	mutexState.unlock();
-	return ret;
+	lock_guard<mutex> lock(mutexState);
+	return (int)buildList.size();
 }
 
 void libSfxr::threadSfxr::setFilling(bool s)
 {
-	mutexState.lock();
-	filling = s;
-	mutexState.unlock();
+	{
+		lock_guard<mutex> lock(mutexState);
+		filling = s;
+	}
+	wake.notify_all();
+	built.notify_all();
 }
 
 void libSfxr::threadSfxr::setBuilding(int b)
 {
-	mutexState.lock();
-	building = b;
-	mutexState.unlock();
+	{
+		lock_guard<mutex> lock(mutexState);
+		building = b;
+	}
+	wake.notify_all();
+	built.notify_all();
 }
 
 void libSfxr::threadSfxr::build(int x)
 {
-	mutexSfxr.lock();
+	// push() can grow the list meanwhile, so the entry is looked up locked (entries themselves never move)
+	mutexState.lock();
 	sndParam *ps = buildList[x];
-	if (ps->strLen != 0) pSfxr->loadString(ps->pStr);
+	mutexState.unlock();
+	sndOutput *pOut = render(ps);
+	mutexState.lock();
+	// setBuilding() can rewind over built entries, the first output stays since getOutput() may have handed it out
+	bool first = outputList[x] == nullptr;
+	if (first) outputList[x] = pOut;
+	mutexState.unlock();
+	built.notify_all();
+	if (!first)
+	{
+		if (!pOut->shared) delete[] pOut->pSample;
+		delete pOut->pInfo;
+		delete pOut;
+	}
+}
+
+void libSfxr::threadSfxr::run(job& j)
+{
+	pLib->start(j);
+	sndOutput* pOut = render(j.param);
+	load -= j.cost;
+	pLib->finish(j, pOut);
+}
+
+libSfxr::sndOutput* libSfxr::threadSfxr::render(sndParam* ps)
+{
+	lock_guard<mutex> lock(mutexSfxr);
+	if (ps->strLen != 0) pSfxr->loadBuffer(ps->pStr, ps->strLen);
 	else pSfxr->setParameters(ps->pParam);
-	pSfxr->create();
 	sndOutput *pOut = new sndOutput();
-	pOut->sampleBytes = pSfxr->size(eFormat);
-	pOut->pSample = new char[pOut->sampleBytes];
-	pSfxr->exportBuffer(eFormat,pOut->pSample);
 	pOut->pInfo = new Sfxr::SoundQuickInfo();
-	pSfxr->getInfo(pOut->pInfo);
-	outputList.push_back(pOut);
+	if (pMemory != nullptr)
+	{
+		memoryCache::handle h = pMemory->get(*pSfxr, eFormat, pCache);
+		pOut->sampleBytes = (unsigned int)h->sample.size();
+		pOut->pSample = (char*)h->sample.data();
+		*pOut->pInfo = h->info;
+		pOut->shared = h;
+		return pOut;
+	}
+	// the output is sized from the parameters, so it's allocated before synthing rather than after
+	pOut->sampleBytes = pSfxr->predictSize(eFormat, *pSfxr->getParameters());
+	pOut->pSample = new char[pOut->sampleBytes];
+	if (pCache != nullptr) pCache->exportBuffer(*pSfxr, eFormat, pOut->pSample, pOut->pInfo);
+	else
+	{
+		pSfxr->create();
+		pSfxr->exportBuffer(eFormat, pOut->pSample);
+		pSfxr->getInfo(pOut->pInfo);
+	}
+	return pOut;
+}
+
+void libSfxr::threadSfxr::work()
+{
+	unique_lock<mutex> lock(mutexState);
+	while (true)
+	{
+		// asleep until there's something pushed to build, a library job anywhere, or it's time to stop. A submit()
+		// counts its job before looking for sleepers, and this is set before the count is looked at, so one of them sees the
+		// other. The waker clears it, so the next job wakes another worker
+		sleeping = true;
+		while (filling && building >= (int)buildList.size() && (pLib == nullptr || pLib->queuedJobs == 0))
+		{
+			wake.wait(lock);
+			sleeping = true;
+		}
+		sleeping = false;
+		if (!filling) break;
+		job j;
+		if (pLib != nullptr && pLib->urgentJobs > 0)
+		{
+			lock.unlock();
+			bool urgent = pLib->takeUrgent(this, j);
+			if (urgent) run(j);
+			lock.lock();
+			if (urgent) continue;
+		}
+		if (building < (int)buildList.size())
+		{
+			int b = building;
+			lock.unlock();
+			build(b);
+			lock.lock();
+			building = b + 1;
+			built.notify_all();
+			continue;
+		}
+		lock.unlock();
+		if (pLib->take(this, j)) run(j);
+		lock.lock();
+	}
+	complete = true;
+	built.notify_all();
+	lock.unlock();
+	// a library wait() may be waiting on jobs this worker won't build now
+	if (pLib != nullptr)
+	{
+		lock_guard<mutex> results(pLib->mutexResults);
+		pLib->jobsDone.notify_all();
+	}
+}
+
+void libSfxr::threadSfxr::setCache(renderCache* c)
+{
+	mutexSfxr.lock();
+	pCache = c;
+	mutexSfxr.unlock();
+}
+
+void libSfxr::threadSfxr::setCache(memoryCache* c)
+{
+	mutexSfxr.lock();
+	pMemory = c;
 	mutexSfxr.unlock();
 }
 
@@ -289,30 +467,1207 @@ libSfxr::libSfxr(unsigned int threadCount, unsigned int mode, Sfxr::ExportFormat
 {
 	threadTable.reserve(threadCount);
 	for (unsigned int i = 0; i < threadCount; i++)
+	{
 		threadTable.push_back(new threadSfxr(mode, _format));
+		threadTable.back()->pLib = this;
+	}
+}
+
+libSfxr::~libSfxr()
+{
+	// every worker stops before any is freed, a running one could be stealing from it
+	end();
+	for (threadSfxr* t : threadTable) delete t;
+	job j;
+	while (bulkRing.pop(j))
+		spilled[(int)priority::NORMAL].push_back(move(j));
+	for (job& k : urgentHeap)
+		spilled[(int)priority::NORMAL].push_back(move(k));
+	for (deque<job>& tier : spilled)
+		for (job& k : tier)
+		{
+			if (k.param->strLen != 0) delete[] k.param->pStr;
+			else delete k.param->pParam;
+			delete k.param;
+		}
+	for (unsigned int b = 0; b < SFXR_RESULT_BLOCKS; b++)
+	{
+		atomic<sndOutput*>* block = resultBlocks[b];
+		if (block == nullptr) continue;
+		for (unsigned int i = 0; i < SFXR_RESULT_SEGMENT; i++)
+		{
+			sndOutput* pOut = block[i];
+			if (pOut == nullptr || pOut == &releasedOutput) continue;
+			if (!pOut->shared) delete[] pOut->pSample;
+			delete pOut->pInfo;
+			delete pOut;
+		}
+		delete[] block;
+	}
+}
+
+void libSfxr::begin()
+{
+	for (threadSfxr* t : threadTable) t->begin();
+}
+
+void libSfxr::end()
+{
+	for (threadSfxr* t : threadTable) t->end();
+}
+
+void libSfxr::wait()
+{
+	for (threadSfxr* t : threadTable) t->wait();
+	waiters++;
+	{
+		unique_lock<mutex> lock(mutexResults);
+		// with no worker left running the rest would never be built
+		jobsDone.wait(lock, [this]() { return completed == submitted || !running(); });
+	}
+	waiters--;
+}
+
+libSfxr::sndOutput* libSfxr::wait(unsigned int id)
+{
+	if (id >= submitted) return nullptr;
+	atomic<sndOutput*>& slot = resultSlot(id);
+	waiters++;
+	{
+		unique_lock<mutex> lock(mutexResults);
+		jobsDone.wait(lock, [&]() { return slot != nullptr || !running(); });
+	}
+	waiters--;
+	sndOutput* pOut = slot;
+	return pOut != &releasedOutput ? pOut : nullptr;
+}
+
+bool libSfxr::running()
+{
+	for (threadSfxr* t : threadTable)
+		if (t->isFilling()) return true;
+	return false;
+}
+
+unsigned int libSfxr::drain()
+{
+	// taken off the queue first, so a callback can submit more (or drain) without deadlocking
+	deque<completion> now;
+	completion c;
+	while (drainQueue.pop(c))
+		now.push_back(move(c));
+	{
+		lock_guard<mutex> lock(mutexDrain);
+		for (completion& d : drainSpilled)
+			now.push_back(move(d));
+		drainSpilled.clear();
+	}
+	for (completion& d : now)
+		d.done(d.id, d.pOut);
+	return (unsigned int)now.size();
+}
+
+atomic<libSfxr::sndOutput*>& libSfxr::resultSlot(unsigned int id)
+{
+	atomic<atomic<sndOutput*>*>& b = resultBlocks[id / SFXR_RESULT_SEGMENT];
+	atomic<sndOutput*>* block = b.load(memory_order_acquire);
+	if (block == nullptr)
+	{
+		// whoever gets there first makes the block, the others drop theirs
+		atomic<sndOutput*>* made = new atomic<sndOutput*>[SFXR_RESULT_SEGMENT];
+		for (unsigned int i = 0; i < SFXR_RESULT_SEGMENT; i++) made[i].store(nullptr, memory_order_relaxed);
+		if (b.compare_exchange_strong(block, made, memory_order_acq_rel)) block = made;
+		else delete[] made;
+	}
+	return block[id % SFXR_RESULT_SEGMENT];
+}
+
+unsigned int libSfxr::reserve(unsigned int n)
+{
+	// checked before the ids are claimed, a count left past what's built would hang wait()
+	unsigned int first = submitted;
+	do
+	{
+		if ((unsigned long long)first + n > (unsigned long long)SFXR_RESULT_BLOCKS * SFXR_RESULT_SEGMENT)
+			throw new runtime_error("too many sounds submitted to one library in libSfxr::reserve()");
+	} while (!submitted.compare_exchange_weak(first, first + n));
+	// each block is made now rather than by the worker, so finishing never allocates
+	for (unsigned long long id = first; id < (unsigned long long)first + n; id += SFXR_RESULT_SEGMENT)
+		resultSlot((unsigned int)id);
+	resultSlot(first + n - 1);
+	return first;
+}
+
+// the heap order: true if a is due after b, ties going cheapest (then first submitted) first
+static bool dueAfter(const libSfxr::job& a, const libSfxr::job& b)
+{
+	if (a.deadline != b.deadline) return a.deadline > b.deadline;
+	if (a.cost != b.cost) return a.cost > b.cost;
+	return a.id > b.id;
+}
+
+void libSfxr::enqueue(job& j)
+{
+	// counted first, so a worker popping it can't take the count below zero (one that sees the count early looks again)
+	queuedJobs++;
+	if (j.pri == priority::URGENT)
+	{
+		urgentJobs++;
+		lock_guard<mutex> lock(mutexUrgent);
+		urgentHeap.push_back(move(j));
+		push_heap(urgentHeap.begin(), urgentHeap.end(), dueAfter);
+		return;
+	}
+	if (j.pri == priority::BULK)
+	{
+		bulkJobs++;
+		if (bulkRing.push(j)) return;
+		lock_guard<mutex> lock(mutexSpill);
+		spilled[(int)j.pri].push_back(move(j));
+		spilledJobs++;
+		spillCount++;
+		return;
+	}
+	// the least loaded worker gets it, or the next with room, and only if every ring is full is a lock taken
+	size_t count = threadTable.size(), to = 0;
+	for (size_t i = 1; i < count; i++)
+		if (threadTable[i]->load < threadTable[to]->load) to = i;
+	unsigned int cost = j.cost;
+	for (size_t k = 0; k < count; k++)
+	{
+		threadSfxr* t = threadTable[(to + k) % count];
+		t->load += cost;
+		if (t->jobs.push(j)) return;
+		t->load -= cost;
+	}
+	lock_guard<mutex> lock(mutexSpill);
+	spilled[(int)priority::NORMAL].push_back(move(j));
+	spilledJobs++;
+	spillCount++;
+}
+
+void libSfxr::wake(size_t n)
+{
+	// only a sleeping worker needs its lock taken, so it can't be between checking for jobs and going to sleep, and
+	// one is enough for one job (whichever it is, it steals the job if it isn't its own)
+	for (threadSfxr* t : threadTable)
+	{
+		if (n == 0) return;
+		if (!t->sleeping) continue;
+		{
+			lock_guard<mutex> lock(t->mutexState);
+			if (!t->sleeping) continue;
+			t->sleeping = false;
+		}
+		t->wake.notify_one();
+		n--;
+	}
+}
+
+// costs are predicted on the submitting thread, so submitters never wait on each other for it
+static Sfxr& costSfxr()
+{
+	static thread_local Sfxr s;
+	return s;
+}
+
+void libSfxr::schedule(job& j, priority pri, float deadlineMs, const callback& done, deliver on)
+{
+	j.done = done;
+	j.on = on;
+	j.queued = chrono::steady_clock::now();
+	j.timed = deadlineMs > 0.0f;
+	j.deadline = j.timed ? j.queued + chrono::microseconds((long long)(deadlineMs * 1000.0f)) : j.queued;
+	j.pri = j.timed ? priority::URGENT : pri;
+	enqueue(j);
+}
+
+unsigned int libSfxr::submit(const Sfxr::Parameters& p, callback done, deliver on)
+{
+	return submit(p, priority::NORMAL, 0.0f, move(done), on);
+}
+
+unsigned int libSfxr::submit(const char* str, unsigned int len, callback done, deliver on)
+{
+	return submit(str, len, priority::NORMAL, 0.0f, move(done), on);
+}
+
+unsigned int libSfxr::submit(const Sfxr::Parameters* p, unsigned int n, callback done, deliver on)
+{
+	return submit(p, n, priority::NORMAL, 0.0f, move(done), on);
+}
+
+unsigned int libSfxr::submit(const Sfxr::Parameters& p, priority pri, float deadlineMs, callback done, deliver on)
+{
+	job j;
+	j.id = reserve(1);
+	j.cost = costSfxr().predictLength(p);
+	j.param = new sndParam(p);
+	schedule(j, pri, deadlineMs, done, on);
+	wake(1);
+	return j.id;
+}
+
+unsigned int libSfxr::submit(const char* str, unsigned int len, priority pri, float deadlineMs, callback done, deliver on)
+{
+	if (len == 0) len = (unsigned int)strlen(str);
+	char* buff = new char[len];
+	memcpy(buff, str, len);
+	job j;
+	j.id = reserve(1);
+	Sfxr& c = costSfxr();
+	if (c.loadBuffer(buff, len, false))
+		j.cost = c.predictLength(*c.getParameters());
+	j.param = new sndParam(buff, len);
+	schedule(j, pri, deadlineMs, done, on);
+	wake(1);
+	return j.id;
+}
+
+unsigned int libSfxr::submit(const Sfxr::Parameters* p, unsigned int n, priority pri, float deadlineMs, callback done, deliver on)
+{
+	if (n == 0) return submitted;
+	unsigned int first = reserve(n);
+	// ids in the order given, but handed out costliest first, so each goes where there's least work so far (urgent ones
+	// are ordered by the heap)
+	Sfxr& c = costSfxr();
+	vector<pair<unsigned int, unsigned int>> order(n);
+	for (unsigned int i = 0; i < n; i++)
+		order[i] = { c.predictLength(p[i]), i };
+	stable_sort(order.begin(), order.end(), [](const pair<unsigned int, unsigned int>& x, const pair<unsigned int, unsigned int>& y) { return x.first > y.first; });
+	for (const pair<unsigned int, unsigned int>& o : order)
+	{
+		job j;
+		j.id = first + o.second;
+		j.cost = o.first;
+		j.param = new sndParam(p[o.second]);
+		schedule(j, pri, deadlineMs, done, on);
+	}
+	wake(n);
+	return first;
+}
+
+bool libSfxr::unspill(priority pri, job& j)
+{
+	if (spilledJobs == 0) return false;
+	lock_guard<mutex> lock(mutexSpill);
+	deque<job>& tier = spilled[(int)pri];
+	if (tier.empty()) return false;
+	j = move(tier.front());
+	tier.pop_front();
+	spilledJobs--;
+	return true;
+}
+
+bool libSfxr::takeUrgent(threadSfxr* t, job& j)
+{
+	if (urgentJobs == 0) return false;
+	{
+		lock_guard<mutex> lock(mutexUrgent);
+		if (urgentHeap.empty()) return false;
+		pop_heap(urgentHeap.begin(), urgentHeap.end(), dueAfter);
+		j = move(urgentHeap.back());
+		urgentHeap.pop_back();
+	}
+	urgentJobs--;
+	queuedJobs--;
+	t->load += j.cost;
+	return true;
+}
+
+bool libSfxr::take(threadSfxr* t, job& j)
+{
+	if (takeUrgent(t, j)) return true;
+	if (t->jobs.pop(j))
+	{
+		queuedJobs--;
+		return true;
+	}
+	if (unspill(priority::NORMAL, j))
+	{
+		t->load += j.cost;
+		queuedJobs--;
+		return true;
+	}
+	// out of its own, so the oldest job of the most loaded other worker (a batch is queued costliest first, so that's its
+	// longest). Another thief may be quicker, then look again
+	while (true)
+	{
+		threadSfxr* from = nullptr;
+		for (threadSfxr* v : threadTable)
+			if (v != t && !v->jobs.empty() && (from == nullptr || v->load > from->load)) from = v;
+		if (from == nullptr) break;
+		if (!from->jobs.pop(j))
+		{
+			// its push may be half way, give it the cpu
+			this_thread::yield();
+			continue;
+		}
+		from->load -= j.cost;
+		t->load += j.cost;
+		queuedJobs--;
+		stealCount++;
+		return true;
+	}
+	// bulk only once there's no other job queued anywhere
+	if (bulkJobs == 0 || !(bulkRing.pop(j) || unspill(priority::BULK, j))) return false;
+	bulkJobs--;
+	queuedJobs--;
+	t->load += j.cost;
+	return true;
+}
+
+static void raiseTo(atomic<unsigned long long>& worst, unsigned long long v)
+{
+	unsigned long long w = worst;
+	while (v > w && !worst.compare_exchange_weak(w, v)) {}
+}
+
+void libSfxr::start(job& j)
+{
+	raiseTo(worstWait[(int)j.pri], (unsigned long long)chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - j.queued).count());
+}
+
+void libSfxr::finish(job& j, sndOutput* pOut)
+{
+	if (j.param->strLen != 0) delete[] j.param->pStr;
+	else delete j.param->pParam;
+	delete j.param;
+	// queued for drain() before the result shows, so a drain() after wait() has every one
+	if (j.done && j.on == deliver::DRAIN)
+	{
+		completion c;
+		c.id = j.id;
+		c.pOut = pOut;
+		c.done = move(j.done);
+		if (!drainQueue.push(c))
+		{
+			lock_guard<mutex> lock(mutexDrain);
+			drainSpilled.push_back(move(c));
+			spillCount++;
+		}
+	}
+	builtBy[(int)j.pri]++;
+	if (j.timed)
+	{
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		deadlineCount++;
+		if (now > j.deadline)
+		{
+			missCount++;
+			raiseTo(worstLate, (unsigned long long)chrono::duration_cast<chrono::microseconds>(now - j.deadline).count());
+		}
+	}
+	resultSlot(j.id) = pOut;
+	completed++;
+	// the result is stored before the waiters are counted, and a wait() counts itself before looking, so one sees the other
+	if (waiters > 0)
+	{
+		{
+			lock_guard<mutex> lock(mutexResults);
+		}
+		jobsDone.notify_all();
+	}
+	// on this worker, with no lock held
+	if (j.done && j.on == deliver::WORKER) j.done(j.id, pOut);
+}
+
+libSfxr::sndOutput libSfxr::releasedOutput;
+
+bool libSfxr::isDone(unsigned int id)
+{
+	if (id >= submitted) return false;
+	atomic<sndOutput*>* block = resultBlocks[id / SFXR_RESULT_SEGMENT].load(memory_order_acquire);
+	return block != nullptr && block[id % SFXR_RESULT_SEGMENT].load() != nullptr;
+}
+
+bool libSfxr::release(unsigned int id)
+{
+	if (id >= submitted) return false;
+	atomic<sndOutput*>& slot = resultSlot(id);
+	sndOutput* pOut = slot;
+	// only once it's built, and only by one caller
+	if (pOut == nullptr || pOut == &releasedOutput || !slot.compare_exchange_strong(pOut, &releasedOutput)) return false;
+	if (!pOut->shared) delete[] pOut->pSample;
+	delete pOut->pInfo;
+	delete pOut;
+	return true;
+}
+
+libSfxr::sndOutput* libSfxr::result(unsigned int id)
+{
+	if (id >= submitted || id >= SFXR_RESULT_BLOCKS * SFXR_RESULT_SEGMENT) return nullptr;
+	atomic<sndOutput*>* block = resultBlocks[id / SFXR_RESULT_SEGMENT].load(memory_order_acquire);
+	sndOutput* pOut = block != nullptr ? block[id % SFXR_RESULT_SEGMENT].load() : nullptr;
+	return pOut != &releasedOutput ? pOut : nullptr;
+}
+
+unsigned int libSfxr::steals()
+{
+	return stealCount;
+}
+
+unsigned int libSfxr::spills()
+{
+	return spillCount;
+}
+
+libSfxr::schedStats libSfxr::stats()
+{
+	schedStats st;
+	for (int i = 0; i < 3; i++)
+	{
+		st.built[i] = builtBy[i];
+		st.worstWaitMs[i] = worstWait[i] / 1000.0;
+	}
+	st.deadlines = deadlineCount;
+	st.missed = missCount;
+	st.worstLateMs = worstLate / 1000.0;
+	return st;
+}
+
+void libSfxr::setCache(renderCache* c)
+{
+	for (threadSfxr* t : threadTable) t->setCache(c);
+}
+
+void libSfxr::setCache(memoryCache* c)
+{
+	for (threadSfxr* t : threadTable) t->setCache(c);
+}
+
+// *******************************************************************************
+// sound banks
+static_assert(sizeof(libSfxr::bankHeader) == 56 && sizeof(libSfxr::bankEntry) == 160, "sound bank layout must not change");
+
+uint32_t libSfxr::bankHash(const char* name, size_t length)
+{
+	// FNV-1a
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < length; i++)
+	{
+		h ^= (uint8_t)name[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+libSfxr::soundBank::~soundBank()
+{
+	close();
+}
+
+bool libSfxr::soundBank::attach(const void* p, size_t size)
+{
+	// everything is checked once here, so lookups only need to bound the id
+	const bankHeader* h = (const bankHeader*)p;
+	if (p == nullptr || size < sizeof(bankHeader)) return false;
+	if (memcmp(h->magic, "SFXB", 4) != 0 || h->version != SFXR_BANK_VERSION || h->size > size) return false;
+	if (h->slots == 0 || (h->slots & (h->slots - 1)) != 0 || h->slots < h->count) return false;
+	if (h->entries % 8 != 0 || h->entries > h->size || (h->size - h->entries) / sizeof(bankEntry) < h->count) return false;
+	if (h->table % 4 != 0 || h->table > h->size || (h->size - h->table) / sizeof(uint32_t) < h->slots) return false;
+	if (h->names > h->size || h->data > h->size) return false;
+	base = (const char*)p;
+	bytes = (size_t)h->size;
+	header = h;
+	entries = (const bankEntry*)(base + h->entries);
+	table = (const uint32_t*)(base + h->table);
+	return true;
+}
+
+bool libSfxr::soundBank::open(const char* fname)
+{
+	close();
+#ifdef _WIN32
+	HANDLE f = CreateFileA(fname, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (f == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER size;
+	HANDLE m = nullptr;
+	const void* view = nullptr;
+	if (GetFileSizeEx(f, &size) && size.QuadPart > 0) m = CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (m != nullptr) view = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+	if (view == nullptr || !attach(view, (size_t)size.QuadPart))
+	{
+		if (view != nullptr) UnmapViewOfFile(view);
+		if (m != nullptr) CloseHandle(m);
+		CloseHandle(f);
+		return false;
+	}
+	hFile = f;
+	hMap = m;
+#else
+	int fd = ::open(fname, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	void* view = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	// the mapping keeps the file, the descriptor isn't needed past here
+	::close(fd);
+	if (view == MAP_FAILED) return false;
+	if (!attach(view, (size_t)st.st_size))
+	{
+		munmap(view, (size_t)st.st_size);
+		return false;
+	}
+	// it's the whole file that was mapped, even if the bank says it ends sooner
+	mapBytes = (size_t)st.st_size;
+#endif
+	mapped = true;
+	return true;
+}
+
+bool libSfxr::soundBank::openMemory(const void* p, size_t size)
+{
+	close();
+	return attach(p, size);
+}
+
+void libSfxr::soundBank::close()
+{
+	if (mapped)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(base);
+		CloseHandle((HANDLE)hMap);
+		CloseHandle((HANDLE)hFile);
+#else
+		munmap((void*)base, mapBytes);
+#endif
+	}
+	mapped = false;
+	base = nullptr;
+	bytes = mapBytes = 0;
+	header = nullptr;
+	entries = nullptr;
+	table = nullptr;
+	hFile = hMap = nullptr;
+}
+
+unsigned int libSfxr::soundBank::count()
+{
+	return header != nullptr ? header->count : 0;
+}
+
+int libSfxr::soundBank::find(const char* name)
+{
+	if (header == nullptr || name == nullptr) return -1;
+	size_t length = strlen(name);
+	uint32_t hash = bankHash(name, length);
+	uint32_t mask = header->slots - 1;
+	// linear probing, the table is at most half full so this ends quickly on an empty slot
+	for (uint32_t i = 0, slot = hash & mask; i < header->slots; i++, slot = (slot + 1) & mask)
+	{
+		uint32_t id = table[slot];
+		if (id == 0 || id > header->count) return -1;
+		const bankEntry& e = entries[id - 1];
+		if (e.hash == hash && e.nameLength == length && header->names + e.name + length < bytes && memcmp(base + header->names + e.name, name, length) == 0)
+			return (int)(id - 1);
+	}
+	return -1;
+}
+
+const char* libSfxr::soundBank::name(unsigned int id)
+{
+	if (id >= count()) throw new runtime_error("invalid id into libSfxr::soundBank::name()");
+	const bankEntry& e = entries[id];
+	if (header->names + e.name + e.nameLength >= bytes || base[header->names + e.name + e.nameLength] != 0)
+		throw new runtime_error("bad name in libSfxr::soundBank::name()");
+	return base + header->names + e.name;
+}
+
+const Sfxr::Parameters* libSfxr::soundBank::parameters(unsigned int id)
+{
+	if (id >= count()) throw new runtime_error("invalid id into libSfxr::soundBank::parameters()");
+	return &entries[id].param;
+}
+
+float libSfxr::soundBank::soundVol(unsigned int id)
+{
+	if (id >= count()) throw new runtime_error("invalid id into libSfxr::soundBank::soundVol()");
+	return entries[id].sound_vol;
+}
+
+const void* libSfxr::soundBank::data(unsigned int id, unsigned int* size)
+{
+	if (id >= count()) throw new runtime_error("invalid id into libSfxr::soundBank::data()");
+	const bankEntry& e = entries[id];
+	if (header->data + e.data + e.dataSize > bytes) throw new runtime_error("bad data in libSfxr::soundBank::data()");
+	if (size != nullptr) *size = e.dataSize;
+	return e.dataSize > 0 ? base + header->data + e.data : nullptr;
+}
+
+void libSfxr::soundBank::apply(unsigned int id, Sfxr& sfxr)
+{
+	unsigned int size = 0;
+	const void* p = data(id, &size);
+	sfxr.setParameters((Sfxr::Parameters*)parameters(id));
+	sfxr.setVolume(soundVol(id));
+	sfxr.setData((void*)p, size, false);
+}
+
+unsigned int libSfxr::soundBankWriter::add(const char* name, const Sfxr::Parameters& param, float sound_vol, const void* pData, unsigned int size)
+{
+	if (name == nullptr) throw new runtime_error("no name given to libSfxr::soundBankWriter::add()");
+	size_t length = strlen(name);
+	uint32_t hash = bankHash(name, length);
+	auto same = byHash.equal_range(hash);
+	for (auto it = same.first; it != same.second; ++it)
+	{
+		const bankEntry& e = entries[it->second];
+		if (e.nameLength == length && memcmp(names.data() + e.name, name, length) == 0)
+			throw new runtime_error("duplicate name in libSfxr::soundBankWriter::add()");
+	}
+	bankEntry e{};
+	e.param = param;
+	e.sound_vol = sound_vol;
+	e.hash = hash;
+	e.name = (uint32_t)names.size();
+	e.nameLength = (uint32_t)length;
+	names.insert(names.end(), name, name + length + 1);
+	// each sound's data starts 8 byte aligned, so it can be read in place
+	e.data = (uint64_t)data.size();
+	e.dataSize = pData != nullptr ? size : 0;
+	if (e.dataSize > 0)
+	{
+		data.insert(data.end(), (const char*)pData, (const char*)pData + size);
+		data.resize((data.size() + 7) & ~(size_t)7, 0);
+	}
+	entries.push_back(e);
+	byHash.emplace(hash, (unsigned int)entries.size() - 1);
+	return (unsigned int)entries.size() - 1;
+}
+
+unsigned int libSfxr::soundBankWriter::add(const char* name, Sfxr& sfxr)
+{
+	return add(name, *sfxr.getParameters(), sfxr.getVolume(), sfxr.getData(), sfxr.getDataSize());
+}
+
+unsigned int libSfxr::soundBankWriter::count()
+{
+	return (unsigned int)entries.size();
+}
+
+bool libSfxr::soundBankWriter::write(std::ostream& ofs)
+{
+	bankHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, "SFXB", 4);
+	h.version = SFXR_BANK_VERSION;
+	h.count = (uint32_t)entries.size();
+	h.slots = 16;
+	while (h.slots < h.count * 2) h.slots <<= 1;
+	h.entries = (sizeof(bankHeader) + 7) & ~(uint64_t)7;
+	h.table = h.entries + sizeof(bankEntry) * (uint64_t)h.count;
+	h.names = h.table + sizeof(uint32_t) * (uint64_t)h.slots;
+	h.data = (h.names + names.size() + 7) & ~(uint64_t)7;
+	h.size = h.data + data.size();
+
+	vector<uint32_t> table(h.slots, 0);
+	for (uint32_t id = 0; id < h.count; id++)
+	{
+		uint32_t slot = entries[id].hash & (h.slots - 1);
+		while (table[slot] != 0) slot = (slot + 1) & (h.slots - 1);
+		table[slot] = id + 1;
+	}
+
+	const char zero[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+	ofs.write((const char*)&h, sizeof(h));
+	ofs.write(zero, (size_t)(h.entries - sizeof(h)));
+	if (!entries.empty()) ofs.write((const char*)entries.data(), sizeof(bankEntry) * entries.size());
+	ofs.write((const char*)table.data(), sizeof(uint32_t) * table.size());
+	if (!names.empty()) ofs.write(names.data(), names.size());
+	ofs.write(zero, (size_t)(h.data - h.names - names.size()));
+	if (!data.empty()) ofs.write(data.data(), data.size());
+	return ofs.good();
+}
+
+bool libSfxr::soundBankWriter::writeFile(const char* fname)
+{
+	ofstream ofs(fname, ios::binary);
+	return write(ofs);
+}
+
+// *******************************************************************************
+// render cache
+static_assert(sizeof(libSfxr::renderCache::cacheKey) == 152, "cache key must have no padding, it's hashed and compared as bytes");
+
+namespace {
+	// what's at the top of each cache file, the key is kept whole so a hash collision reads as a miss
+	struct cacheFile {
+		char magic[4];			// "SFXC"
+		uint32_t dataSize;
+		uint64_t hash;
+		libSfxr::renderCache::cacheKey key;
+		Sfxr::SoundQuickInfo info;
+	};
+}
+
+libSfxr::renderCache::renderCache(const char* directory) : dir(directory)
+{
+	error_code ec;
+	filesystem::create_directories(dir, ec);
+	if (!filesystem::is_directory(dir, ec)) throw new runtime_error("can't make the cache directory in libSfxr::renderCache::renderCache()");
+}
+
+void libSfxr::renderCache::makeKey(Sfxr& sfxr, Sfxr::ExportFormat f, cacheKey& key)
+{
+	key = cacheKey{};
+	key.param = *sfxr.getParameters();
+	key.sound_vol = sfxr.getVolume();
+	key.mode = sfxr.getMode();
+	key.sampleRate = sfxr.getSampleRate();
+	// the PCM formats pick their own bit depth on export
+	switch (f)
+	{
+	case Sfxr::ExportFormat::PCM8: key.bitDepth = 8; break;
+	case Sfxr::ExportFormat::PCM16: key.bitDepth = 16; break;
+	case Sfxr::ExportFormat::PCM24: key.bitDepth = 24; break;
+	case Sfxr::ExportFormat::PCM32: key.bitDepth = 32; break;
+	default: key.bitDepth = sfxr.getBitDepth(); break;
+	}
+	key.format = (uint32_t)f;
+	key.version = SFXR_CACHE_VERSION;
+}
+
+uint64_t libSfxr::renderCache::hash(const cacheKey& key)
+{
+	// FNV-1a 64
+	const uint8_t* p = (const uint8_t*)&key;
+	uint64_t h = 14695981039346656037ull;
+	for (size_t i = 0; i < sizeof(cacheKey); i++)
+	{
+		h ^= p[i];
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+string libSfxr::renderCache::path(uint64_t hash)
+{
+	char name[24];
+	snprintf(name, sizeof(name), "%016llx.sfxc", (unsigned long long)hash);
+	return (filesystem::path(dir) / name).string();
+}
+
+unsigned int libSfxr::renderCache::size(Sfxr& sfxr, Sfxr::ExportFormat f)
+{
+	return sfxr.predictSize(f, *sfxr.getParameters());
+}
+
+bool libSfxr::renderCache::load(const cacheKey& key, void* pData, unsigned int size, Sfxr::SoundQuickInfo* info)
+{
+	cacheFile h;
+	uint64_t hs = hash(key);
+	ifstream ifs(path(hs), ios::binary);
+	if (!ifs.is_open()) return false;
+	if (!ifs.read((char*)&h, sizeof(cacheFile))) return false;
+	if (memcmp(h.magic, "SFXC", 4) != 0 || h.hash != hs || h.dataSize != size) return false;
+	if (memcmp(&h.key, &key, sizeof(cacheKey)) != 0) return false;
+	if (!ifs.read((char*)pData, size)) return false;
+	if (info != nullptr) *info = h.info;
+	return true;
+}
+
+bool libSfxr::renderCache::store(const cacheKey& key, const void* pData, unsigned int size, const Sfxr::SoundQuickInfo& info)
+{
+	cacheFile h{};
+	memcpy(h.magic, "SFXC", 4);
+	h.dataSize = size;
+	h.hash = hash(key);
+	h.key = key;
+	h.info = info;
+	// written aside then renamed in, so a reader (or another thread or process storing the same sound) never sees half a
+	// file: the name is unique to this process and this store
+	static atomic<unsigned int> stores{ 0 };
+#ifdef _WIN32
+	unsigned long pid = GetCurrentProcessId();
+#else
+	unsigned long pid = (unsigned long)getpid();
+#endif
+	string fname = path(h.hash);
+	string tmp = fname + "." + to_string(pid) + "." + to_string(stores++) + ".tmp";
+	{
+		ofstream ofs(tmp, ios::binary);
+		if (!ofs.is_open()) return false;
+		ofs.write((const char*)&h, sizeof(cacheFile));
+		ofs.write((const char*)pData, size);
+		if (!ofs.good()) { ofs.close(); remove(tmp.c_str()); return false; }
+	}
+	error_code ec;
+	filesystem::rename(tmp, fname, ec);
+	if (ec) { remove(tmp.c_str()); return false; }
+	return true;
+}
+
+bool libSfxr::renderCache::exportBuffer(Sfxr& sfxr, Sfxr::ExportFormat f, void* pData, Sfxr::SoundQuickInfo* info)
+{
+	cacheKey key;
+	Sfxr::SoundQuickInfo qi;
+	makeKey(sfxr, f, key);
+	unsigned int bytes = size(sfxr, f);
+	if (load(key, pData, bytes, &qi))
+	{
+		hitCount++;
+		// leave the Sfxr set up as its own export would have
+		if (f >= Sfxr::ExportFormat::PCM8 && f <= Sfxr::ExportFormat::PCM32) sfxr.setPCM(SFXR_SAMPLERATE_INVALID, key.bitDepth);
+		if (info != nullptr) *info = qi;
+		return true;
+	}
+	missCount++;
+	sfxr.create();
+	if (!sfxr.exportBuffer(f, pData)) return false;
+	sfxr.getInfo(&qi);
+	store(key, pData, bytes, qi);
+	if (info != nullptr) *info = qi;
+	return true;
+}
+
+unsigned int libSfxr::renderCache::hits() { return hitCount; }
+unsigned int libSfxr::renderCache::misses() { return missCount; }
+
+// *******************************************************************************
+// memory cache
+libSfxr::memoryCache::memoryCache(size_t budget) : budgetBytes(budget)
+{
 }
 
-unsigned int libSfxr_threadSfxr(void* p)
+libSfxr::memoryCache::handle libSfxr::memoryCache::get(Sfxr& sfxr, Sfxr::ExportFormat f, renderCache* disk)
 {
-	libSfxr::threadSfxr* pt = (libSfxr::threadSfxr*)p;
+	renderCache::cacheKey key;
+	renderCache::makeKey(sfxr, f, key);
+	handle h = find(key);
+	if (h) return h;
+	// rendered unlocked, other threads keep hitting meanwhile, and a race on the same sound just keeps the first
+	shared_ptr<sound> snd = make_shared<sound>();
+	snd->sample.resize(sfxr.predictSize(f, *sfxr.getParameters()));
+	if (disk != nullptr) disk->exportBuffer(sfxr, f, snd->sample.data(), &snd->info);
+	else
+	{
+		sfxr.create();
+		sfxr.exportBuffer(f, snd->sample.data());
+		sfxr.getInfo(&snd->info);
+	}
+	return insert(key, snd);
+}
+
+libSfxr::memoryCache::handle libSfxr::memoryCache::find(const renderCache::cacheKey& key)
+{
+	uint64_t hs = renderCache::hash(key);
+	lock_guard<mutex> lock(mutexCache);
+	auto it = index.find(hs);
+	if (it == index.end() || memcmp(&it->second->key, &key, sizeof(renderCache::cacheKey)) != 0)
+	{
+		missCount++;
+		return handle();
+	}
+	lru.splice(lru.begin(), lru, it->second);
+	hitCount++;
+	return it->second->snd;
+}
+
+libSfxr::memoryCache::handle libSfxr::memoryCache::insert(const renderCache::cacheKey& key, handle snd)
+{
+	uint64_t hs = renderCache::hash(key);
+	lock_guard<mutex> lock(mutexCache);
+	auto it = index.find(hs);
+	if (it != index.end())
+	{
+		if (memcmp(&it->second->key, &key, sizeof(renderCache::cacheKey)) == 0)
+		{
+			lru.splice(lru.begin(), lru, it->second);
+			return it->second->snd;
+		}
+		// a different sound with the same hash makes way
+		usedBytes -= it->second->snd->sample.size();
+		lru.erase(it->second);
+		index.erase(it);
+		evictCount++;
+	}
+	lru.push_front(entry{ key, snd });
+	index[hs] = lru.begin();
+	usedBytes += snd->sample.size();
+	trim();
+	// still returned even if it was too big to keep
+	return snd;
+}
+
+void libSfxr::memoryCache::trim()
+{
+	while (usedBytes > budgetBytes && !lru.empty())
+	{
+		entry& e = lru.back();
+		usedBytes -= e.snd->sample.size();
+		index.erase(renderCache::hash(e.key));
+		lru.pop_back();
+		evictCount++;
+	}
+}
+
+void libSfxr::memoryCache::setBudget(size_t budget)
+{
+	lock_guard<mutex> lock(mutexCache);
+	budgetBytes = budget;
+	trim();
+}
+
+size_t libSfxr::memoryCache::budget()
+{
+	lock_guard<mutex> lock(mutexCache);
+	return budgetBytes;
+}
+
+size_t libSfxr::memoryCache::bytes()
+{
+	lock_guard<mutex> lock(mutexCache);
+	return usedBytes;
+}
+
+unsigned int libSfxr::memoryCache::count()
+{
+	lock_guard<mutex> lock(mutexCache);
+	return (unsigned int)lru.size();
+}
+
+void libSfxr::memoryCache::clear()
+{
+	lock_guard<mutex> lock(mutexCache);
+	lru.clear();
+	index.clear();
+	usedBytes = 0;
+}
+
+unsigned int libSfxr::memoryCache::hits()
+{
+	lock_guard<mutex> lock(mutexCache);
+	return hitCount;
+}
+
+unsigned int libSfxr::memoryCache::misses()
+{
+	lock_guard<mutex> lock(mutexCache);
+	return missCount;
+}
+
+unsigned int libSfxr::memoryCache::evictions()
+{
+	lock_guard<mutex> lock(mutexCache);
+	return evictCount;
+}
+
+// *******************************************************************************
+// lazily rendered bank
+libSfxr::lazyBank::lazyBank(unsigned int threadCount, unsigned int _mode, Sfxr::ExportFormat _format) : mode(_mode), format(_format)
+{
+	workers.reserve(threadCount);
+	for (unsigned int i = 0; i < threadCount; i++)
+		workers.emplace_back(&lazyBank::work, this);
+}
+
+libSfxr::lazyBank::~lazyBank()
+{
+	{
+		lock_guard<mutex> lock(mutexBank);
+		stopping = true;
+	}
+	queued.notify_all();
+	for (thread& t : workers) t.join();
+}
+
+unsigned int libSfxr::lazyBank::add(const Sfxr::Parameters& param, float sound_vol)
+{
+	lock_guard<mutex> lock(mutexBank);
+	entries.emplace_back();
+	entries.back().param = param;
+	entries.back().sound_vol = sound_vol;
+	return (unsigned int)entries.size() - 1;
+}
+
+unsigned int libSfxr::lazyBank::add(soundBank& bank)
+{
+	lock_guard<mutex> lock(mutexBank);
+	unsigned int first = (unsigned int)entries.size();
+	for (unsigned int i = 0; i < bank.count(); i++)
+	{
+		entries.emplace_back();
+		entries.back().param = *bank.parameters(i);
+		entries.back().sound_vol = bank.soundVol(i);
+	}
+	return first;
+}
+
+unsigned int libSfxr::lazyBank::count()
+{
+	lock_guard<mutex> lock(mutexBank);
+	return (unsigned int)entries.size();
+}
 
-	bool ok = true;
-	while (pt->isFilling() && ok)
+void libSfxr::lazyBank::enqueue(unsigned int id, bool now)
+{
+	entry& e = entries[id];
+	if (e.state == IDLE)
+	{
+		e.state = QUEUED;
+		e.asked = now;
+		queuedCount++;
+		if (now) queue.push_front(id);
+		else queue.push_back(id);
+		queued.notify_one();
+	}
+	else if (e.state == QUEUED && now && !e.asked)
 	{
-		// nibble off a sound and build it!
-		int b = pt->getBuilding();
-		int last = pt->getBuildTotal();
-		std::this_thread::yield();
-		if (b < last)
+		// asked for while still waiting behind prefetches, so it jumps them: pushed again rather than found and moved,
+		// the copy left behind is skipped, and only once per queueing so polling get() can't grow the queue
+		e.asked = true;
+		queue.push_front(id);
+		queued.notify_one();
+	}
+}
+
+void libSfxr::lazyBank::take(entry& e)
+{
+	if (e.state == QUEUED) queuedCount--;
+	e.state = RENDERING;
+	e.asked = false;
+}
+
+void libSfxr::lazyBank::prefetch(unsigned int id)
+{
+	lock_guard<mutex> lock(mutexBank);
+	if (id >= entries.size()) throw new runtime_error("no such sound in libSfxr::lazyBank::prefetch()");
+	enqueue(id, false);
+}
+
+void libSfxr::lazyBank::prefetch(const unsigned int* ids, unsigned int n)
+{
+	lock_guard<mutex> lock(mutexBank);
+	for (unsigned int i = 0; i < n; i++)
+	{
+		if (ids[i] >= entries.size()) throw new runtime_error("no such sound in libSfxr::lazyBank::prefetch()");
+		enqueue(ids[i], false);
+	}
+}
+
+bool libSfxr::lazyBank::get(unsigned int id, handle& snd)
+{
+	lock_guard<mutex> lock(mutexBank);
+	if (id >= entries.size()) throw new runtime_error("no such sound in libSfxr::lazyBank::get()");
+	entry& e = entries[id];
+	if (e.state == READY)
+	{
+		snd = e.snd;
+		return true;
+	}
+	enqueue(id, true);
+	return false;
+}
+
+libSfxr::lazyBank::handle libSfxr::lazyBank::wait(unsigned int id)
+{
+	unique_lock<mutex> lock(mutexBank);
+	if (id >= entries.size()) throw new runtime_error("no such sound in libSfxr::lazyBank::wait()");
+	entry& e = entries[id];
+	while (e.state != READY)
+	{
+		if (e.state == RENDERING)
 		{
-			// we have something to build, so build it!
-			pt->build(b);
-			b++;
-			pt->setBuilding(b);
+			finished.wait(lock);
+			continue;
 		}
-		std::this_thread::yield();
+		// taken here, a worker popping it later just skips it (and it's looped on in case of a release() meanwhile)
+		take(e);
+		lock.unlock();
+		Sfxr sfxr;
+		sfxr.setMode(mode);
+		render(sfxr, e);
+		lock.lock();
 	}
-	pt->setComplete(true);
+	return e.snd;
+}
 
-	return 0;
+bool libSfxr::lazyBank::isReady(unsigned int id)
+{
+	lock_guard<mutex> lock(mutexBank);
+	return id < entries.size() && entries[id].state == READY;
+}
+
+void libSfxr::lazyBank::release(unsigned int id)
+{
+	lock_guard<mutex> lock(mutexBank);
+	if (id < entries.size() && entries[id].state == READY)
+	{
+		entries[id].snd.reset();
+		entries[id].state = IDLE;
+	}
+}
+
+unsigned int libSfxr::lazyBank::rendered()
+{
+	lock_guard<mutex> lock(mutexBank);
+	return renderCount;
+}
+
+unsigned int libSfxr::lazyBank::pending()
+{
+	lock_guard<mutex> lock(mutexBank);
+	return queuedCount;
+}
+
+void libSfxr::lazyBank::render(Sfxr& sfxr, entry& e)
+{
+	// parameters never change once added, so they're safe to read unlocked
+	shared_ptr<memoryCache::sound> snd;
+	try
+	{
+		snd = make_shared<memoryCache::sound>();
+		sfxr.setParameters(e.param);
+		sfxr.setVolume(e.sound_vol);
+		snd->sample.resize(sfxr.predictSize(format, e.param));
+		sfxr.create();
+		sfxr.exportBuffer(format, snd->sample.data());
+		sfxr.getInfo(&snd->info);
+	}
+	catch (...)
+	{
+		// not left RENDERING, or every wait() on it would block: the next one asking renders it (and gets the error)
+		{
+			lock_guard<mutex> lock(mutexBank);
+			e.state = IDLE;
+		}
+		finished.notify_all();
+		throw;
+	}
+	{
+		lock_guard<mutex> lock(mutexBank);
+		e.snd = snd;
+		e.state = READY;
+		renderCount++;
+	}
+	finished.notify_all();
+}
+
+void libSfxr::lazyBank::work()
+{
+	Sfxr sfxr;
+	sfxr.setMode(mode);
+	unique_lock<mutex> lock(mutexBank);
+	while (true)
+	{
+		queued.wait(lock, [this]() { return stopping || !queue.empty(); });
+		if (stopping) return;
+		unsigned int id = queue.front();
+		queue.pop_front();
+		entry& e = entries[id];
+		if (e.state != QUEUED) continue;	// wait() took it, or a copy already ran
+		take(e);
+		lock.unlock();
+		try
+		{
+			render(sfxr, e);
+		}
+		catch (...)
+		{
+			// a worker has no one to tell, the sound is IDLE again for whoever asks next
+		}
+		lock.lock();
+	}
 }
@@ -16,6 +16,25 @@
 #include <array>
 #include <thread>
 #include <mutex>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <atomic>
+#include <memory>
+#include <list>
+#include <unordered_map>
+#include <deque>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+
+#define SFXR_BANK_VERSION	1
+#define SFXR_CACHE_VERSION	2	// 2: pink noise restarts with each render
+#define SFXR_JOB_QUEUE		1024	// jobs each library worker's ring holds, more spill to a locked list
+#define SFXR_DRAIN_QUEUE	4096	// built sounds waiting for drain() in its ring, more spill likewise
+#define SFXR_BULK_QUEUE		4096	// bulk jobs likewise
+#define SFXR_RESULT_SEGMENT	4096	// ids per block of the library's result table
+#define SFXR_RESULT_BLOCKS	4096	// blocks, so at most 16M sounds submitted to one library
 
 using namespace std;
 
@@ -40,33 +59,152 @@ public:
 		Sfxr::SoundQuickInfo* pInfo = nullptr;
 		unsigned int sampleBytes = 0;
 		char* pSample = nullptr;
+		shared_ptr<const void> shared;	// set when pSample is shared with a memoryCache, read only then
+	};
+
+	class renderCache;
+	class memoryCache;
+
+	// called once a submitted sound is built, either right away on the worker that built it or later by drain()
+	typedef function<void(unsigned int id, sndOutput* pOut)> callback;
+	enum class deliver { WORKER, DRAIN };
+	// a worker looks for an urgent job before every job it starts (before its own pushed list too), so one waits at most
+	// for the jobs already being built, and urgent jobs go earliest deadline first. Bulk jobs are only started when
+	// there's nothing else queued anywhere
+	enum class priority { URGENT, NORMAL, BULK };
+
+	// a sound submitted to the library as a whole, built by whichever worker gets to it first
+	struct job {
+		sndParam* param = nullptr;
+		unsigned int id = 0;
+		unsigned int cost = 0;	// predicted samples, 0 if the record couldn't be read
+		callback done;
+		deliver on = deliver::DRAIN;
+		priority pri = priority::NORMAL;
+		bool timed = false;		// has a deadline
+		chrono::steady_clock::time_point queued, deadline;	// the deadline is when it was queued if it hasn't one
+	};
+
+	// how the scheduler has done so far
+	struct schedStats {
+		unsigned int built[3] = {};			// by priority
+		unsigned int deadlines = 0;			// built that had one
+		unsigned int missed = 0;			// of those, built after it
+		double worstLateMs = 0.0;			// the furthest past its deadline one was built
+		double worstWaitMs[3] = {};			// the longest one queued before a worker started it, by priority
+	};
+
+	// a bounded lock free queue, any number of threads pushing and popping: each cell has a sequence number that says
+	// whose turn it is, so a push or pop is one compare and swap on the position with no thread ever waiting on another
+	template <class T> class ringQueue
+	{
+	private:
+		struct cell {
+			atomic<size_t> seq;
+			T data;
+		};
+		unique_ptr<cell[]> cells;
+		size_t mask;
+		alignas(64) atomic<size_t> head{ 0 };	// next push
+		alignas(64) atomic<size_t> tail{ 0 };	// next pop
+
+	public:
+		ringQueue(size_t capacity)
+		{
+			size_t n = 2;
+			while (n < capacity) n <<= 1;
+			cells.reset(new cell[n]);
+			for (size_t i = 0; i < n; i++) cells[i].seq.store(i, memory_order_relaxed);
+			mask = n - 1;
+		}
+
+		// false if it's full, v is only moved from when it goes in
+		bool push(T& v)
+		{
+			size_t pos = head.load(memory_order_relaxed);
+			cell* c;
+			while (true)
+			{
+				c = &cells[pos & mask];
+				intptr_t dif = (intptr_t)c->seq.load(memory_order_acquire) - (intptr_t)pos;
+				if (dif == 0 && head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) break;
+				if (dif < 0) return false;
+				if (dif > 0) pos = head.load(memory_order_relaxed);
+			}
+			c->data = move(v);
+			c->seq.store(pos + 1, memory_order_release);
+			return true;
+		}
+
+		// false if it's empty
+		bool pop(T& v)
+		{
+			size_t pos = tail.load(memory_order_relaxed);
+			cell* c;
+			while (true)
+			{
+				c = &cells[pos & mask];
+				intptr_t dif = (intptr_t)c->seq.load(memory_order_acquire) - (intptr_t)(pos + 1);
+				if (dif == 0 && tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) break;
+				if (dif < 0) return false;
+				if (dif > 0) pos = tail.load(memory_order_relaxed);
+			}
+			v = move(c->data);
+			c->data = T();
+			c->seq.store(pos + mask + 1, memory_order_release);
+			return true;
+		}
+
+		bool empty() { return head.load(memory_order_acquire) == tail.load(memory_order_acquire); }	// a hint while others push/pop
 	};
 
-	// the thread magic that allows the system to load/create multiple sounds at once
+	// the thread magic that allows the system to load/create multiple sounds at once: one worker from begin() to end(),
+	// asleep whenever everything pushed is built and woken by the next push()
 	class threadSfxr
 	{
 	private:
 		Sfxr* pSfxr = nullptr;
 		Sfxr::ExportFormat eFormat = Sfxr::ExportFormat::PCM16;
-		thread* pThread = nullptr;
-		mutex mutexSfxr;
-		mutex mutexList;
-		mutex mutexState;
+		thread worker;
+		mutex mutexSfxr;				// held for a build, and to change the caches
+		mutex mutexState;				// held to touch the lists or the state below
+		condition_variable wake;		// the worker waits on it for work
+		condition_variable built;		// wait() and waitOutput() wait on it
 		vector<sndParam*> buildList;
-		vector<sndOutput*> outputList;
-		int building = -1;
-		bool complete = false;
-		bool filling = false;
+		vector<sndOutput*> outputList;	// by push() ticket, nullptr until built
+		atomic<int> building{ -1 };		// written with mutexState held, read by the getters without it
+		atomic<bool> complete{ false };
+		atomic<bool> filling{ false };
+		renderCache* pCache = nullptr;
+		memoryCache* pMemory = nullptr;
+		// the library's jobs: its own share in the order given, taken from the front by it or by an idle worker stealing
+		libSfxr* pLib = nullptr;
+		ringQueue<job> jobs{ SFXR_JOB_QUEUE };
+		atomic<unsigned long long> load{ 0 };	// predicted samples of the jobs queued here and the one being built
+		atomic<bool> sleeping{ false };			// set with mutexState held just before waiting on wake, cleared by whoever wakes it
+
+		void work();
+		void run(job& j);
+		sndOutput* render(sndParam* ps);
+
+		friend class libSfxr;
 
 	public:
 		threadSfxr(unsigned int mode = 0, Sfxr::ExportFormat _format = Sfxr::ExportFormat::PCM16);
+		~threadSfxr();	// ends the worker, frees what was pushed and built
+		threadSfxr(const threadSfxr&) = delete;
+		threadSfxr& operator=(const threadSfxr&) = delete;
 
-		void push(Sfxr::Parameters& p);
-		void push(Sfxr::Parameters* p);
-		void push(const char *str, unsigned int len = 0);
+		// each returns a ticket, the sound's place in the build list, to get its output by
+		unsigned int push(Sfxr::Parameters& p);
+		unsigned int push(Sfxr::Parameters* p);
+		unsigned int push(const char *str, unsigned int len = 0);
+		sndOutput* getOutput(unsigned int ticket);	// nullptr until it's built
+		sndOutput* waitOutput(unsigned int ticket);	// blocks until it's built, nullptr if the worker ends first
 
-		void begin();
-		void end();
+		void begin();	// start the worker, it carries on from where the last end() left it
+		void end();		// stop after the sound being built, joins the worker
+		void wait();	// block until everything pushed so far is built (or the worker ends)
 
 		bool isFilling();
 		bool isComplete();
@@ -78,9 +216,319 @@ public:
 		void setBuilding(int b);
 
 		void build(int x);
+		void setCache(renderCache* c);	// build through a render cache, nullptr to stop
+		void setCache(memoryCache* c);	// (both can be set, the memory cache is asked first)
+	};
+
+	// a bank of presets in one file, made to be used straight from memory (mmap) with no parsing or allocation per sound:
+	// header, then a table of entries by id, a name hash table, the names and the attached data, all little endian
+	struct bankHeader {
+		char magic[4];			// 'S', 'F', 'X', 'B'
+		uint32_t version;		// SFXR_BANK_VERSION
+		uint32_t count;			// entries
+		uint32_t slots;			// name hash table slots, a power of 2 at least twice count
+		uint64_t entries;		// offsets from the start of the bank of each section
+		uint64_t table;			// slots of uint32_t, each an id + 1, or 0 for an empty slot
+		uint64_t names;			// NUL terminated
+		uint64_t data;
+		uint64_t size;			// the whole bank in bytes
+	};
+
+	struct bankEntry {
+		Sfxr::Parameters param;
+		float sound_vol;
+		uint32_t hash;			// libSfxr::bankHash() of the name
+		uint32_t name;			// offset into the names
+		uint32_t nameLength;	// without the NUL
+		uint64_t data;			// offset into the data
+		uint32_t dataSize;
+		uint32_t reserved;
+	};
+
+	static uint32_t bankHash(const char* name, size_t length);
+
+	// read a bank: open() maps the file, openMemory() uses one already in memory, lookups by id or name are O(1)
+	// and hand back pointers into the bank, valid until close()
+	class soundBank
+	{
+	private:
+		const char* base = nullptr;
+		size_t bytes = 0;
+		size_t mapBytes = 0;
+		const bankHeader* header = nullptr;
+		const bankEntry* entries = nullptr;
+		const uint32_t* table = nullptr;
+		bool mapped = false;
+		void* hFile = nullptr;		// only used on windows
+		void* hMap = nullptr;
+
+		bool attach(const void* p, size_t size);
+
+	public:
+		soundBank() {}
+		~soundBank();
+		soundBank(const soundBank&) = delete;
+		soundBank& operator=(const soundBank&) = delete;
+
+		bool open(const char* fname);
+		bool openMemory(const void* p, size_t size);	// not copied, it has to outlive the bank
+		void close();
+
+		unsigned int count();
+		int find(const char* name);						// id of the named sound, or -1
+		const char* name(unsigned int id);
+		const Sfxr::Parameters* parameters(unsigned int id);
+		float soundVol(unsigned int id);
+		const void* data(unsigned int id, unsigned int* size = nullptr);
+		// set a sound up from an entry: parameters, volume and its data, referenced in the bank rather than copied
+		void apply(unsigned int id, Sfxr& sfxr);
+	};
+
+	// build a bank, then write it out in one go
+	class soundBankWriter
+	{
+	private:
+		vector<bankEntry> entries;
+		vector<char> names;
+		vector<char> data;
+		unordered_multimap<uint32_t, unsigned int> byHash;	// name hash to entry, to find duplicates
+
+	public:
+		unsigned int add(const char* name, const Sfxr::Parameters& param, float sound_vol = 0.5f, const void* pData = nullptr, unsigned int size = 0);
+		unsigned int add(const char* name, Sfxr& sfxr);		// its parameters, volume and attached data
+		unsigned int count();
+		bool write(std::ostream& ofs);
+		bool writeFile(const char* fname);
+	};
+
+	// rendered exports kept on disk, one file per sound named by a hash of everything that decides its bytes: parameters,
+	// sound_vol, mode, sample rate, bit depth and export format (plus SFXR_CACHE_VERSION, bump it when the synth changes)
+	class renderCache
+	{
+	public:
+		struct cacheKey {
+			Sfxr::Parameters param;
+			float sound_vol;
+			uint32_t mode;
+			uint32_t sampleRate;
+			uint32_t bitDepth;
+			uint32_t format;
+			uint32_t version;		// SFXR_CACHE_VERSION
+		};
+
+	private:
+		string dir;
+		atomic<unsigned int> hitCount{ 0 };
+		atomic<unsigned int> missCount{ 0 };
+
+		string path(uint64_t hash);
+
+	public:
+		renderCache(const char* directory);		// made if it isn't there
+
+		static void makeKey(Sfxr& sfxr, Sfxr::ExportFormat f, cacheKey& key);
+		static uint64_t hash(const cacheKey& key);
+
+		// exportBuffer() through the cache: a hit reads the file straight into pData, a miss synths, exports and stores it,
+		// size() is known up front from the parameters, and info (if given) is filled in as Sfxr::getInfo() would
+		unsigned int size(Sfxr& sfxr, Sfxr::ExportFormat f);
+		bool exportBuffer(Sfxr& sfxr, Sfxr::ExportFormat f, void* pData, Sfxr::SoundQuickInfo* info = nullptr);
+		// or by key, load() is false on a miss (or a file that doesn't match), store() writes a new file in one go
+		bool load(const cacheKey& key, void* pData, unsigned int size, Sfxr::SoundQuickInfo* info = nullptr);
+		bool store(const cacheKey& key, const void* pData, unsigned int size, const Sfxr::SoundQuickInfo& info);
+
+		unsigned int hits();
+		unsigned int misses();
+	};
+
+	// rendered exports kept in memory up to a byte budget, least recently used out first, keyed as renderCache is:
+	// a sound is handed out as a shared handle that's never written again, so it stays good after it's been evicted
+	class memoryCache
+	{
+	public:
+		struct sound {
+			vector<char> sample;
+			Sfxr::SoundQuickInfo info;
+		};
+		typedef shared_ptr<const sound> handle;
+
+	private:
+		struct entry {
+			renderCache::cacheKey key;
+			handle snd;
+		};
+
+		mutex mutexCache;
+		list<entry> lru;			// most recently used first
+		unordered_map<uint64_t, list<entry>::iterator> index;
+		size_t budgetBytes;
+		size_t usedBytes = 0;
+		unsigned int hitCount = 0;
+		unsigned int missCount = 0;
+		unsigned int evictCount = 0;
+
+		void trim();	// mutexCache held
+
+	public:
+		memoryCache(size_t budget);
+		memoryCache(const memoryCache&) = delete;
+		memoryCache& operator=(const memoryCache&) = delete;
+
+		// the export of the Sfxr's current parameters, rendered (through disk if given) and kept on a miss
+		handle get(Sfxr& sfxr, Sfxr::ExportFormat f, renderCache* disk = nullptr);
+		// or by key, find() is empty on a miss, insert() keeps a sound and returns the one kept (an earlier one if raced)
+		handle find(const renderCache::cacheKey& key);
+		handle insert(const renderCache::cacheKey& key, handle snd);
+
+		void setBudget(size_t budget);	// evicts down to it now
+		size_t budget();
+		size_t bytes();
+		unsigned int count();
+		void clear();
+
+		unsigned int hits();
+		unsigned int misses();
+		unsigned int evictions();
+	};
+
+	// parameters for many sounds, each rendered the first time it's asked for, or ahead of time on worker threads when hinted:
+	// get() never waits, it hands over the sound when it's ready and otherwise puts it at the front of the queue. it keeps
+	// its own workers rather than submitting to a libSfxr: its sounds are shared handles that outlive release(), in the
+	// bank's own mode and format, and a library's threads are set up for the library's
+	class lazyBank
+	{
+	public:
+		typedef memoryCache::handle handle;
+
+	private:
+		enum : int { IDLE, QUEUED, RENDERING, READY };
+		struct entry {
+			Sfxr::Parameters param;
+			float sound_vol;
+			int state = IDLE;	// mutexBank held to touch this, asked or snd
+			bool asked = false;	// QUEUED and pushed to the front too, by get()
+			handle snd;
+		};
+
+		mutex mutexBank;
+		condition_variable queued;		// workers wait on it for work
+		condition_variable finished;	// wait() waits on it for another thread's render
+		deque<entry> entries;			// deque, so entries don't move as more are added
+		deque<unsigned int> queue;		// ids, some stale (taken by wait(), or pushed again by get()) and skipped
+		unsigned int queuedCount = 0;	// entries QUEUED, what pending() says
+		vector<thread> workers;
+		unsigned int mode;
+		Sfxr::ExportFormat format;
+		unsigned int renderCount = 0;
+		bool stopping = false;
+
+		void work();
+		void render(Sfxr& sfxr, entry& e);	// e is RENDERING, mutexBank not held, back to IDLE if it throws
+		void take(entry& e);					// QUEUED or IDLE to RENDERING, mutexBank held
+		void enqueue(unsigned int id, bool now);	// mutexBank held
+
+	public:
+		lazyBank(unsigned int threadCount, unsigned int mode = 0, Sfxr::ExportFormat _format = Sfxr::ExportFormat::PCM16);
+		~lazyBank();	// queued sounds not yet started are dropped
+		lazyBank(const lazyBank&) = delete;
+		lazyBank& operator=(const lazyBank&) = delete;
+
+		unsigned int add(const Sfxr::Parameters& param, float sound_vol = 0.5f);	// the id of the sound
+		unsigned int add(soundBank& bank);		// all of a bank's sounds, the id of its first
+		unsigned int count();
+
+		void prefetch(unsigned int id);			// queued behind anything asked for by get()
+		void prefetch(const unsigned int* ids, unsigned int n);
+		bool get(unsigned int id, handle& snd);	// true with the sound if it's ready, never blocks
+		handle wait(unsigned int id);			// blocks, rendering on this thread if no one has started it yet
+		bool isReady(unsigned int id);
+		void release(unsigned int id);			// drop a ready sound, it's rendered again when next asked for
+
+		unsigned int rendered();				// renders done so far
+		unsigned int pending();					// still queued
 	};
 
+private:
+	// submitting and finishing take no lock: ids come from a counter, jobs go through the workers' rings and results are
+	// stored straight into a table of blocks that never move. Locks are only taken to sleep, or when a ring is full
+	atomic<atomic<sndOutput*>*> resultBlocks[SFXR_RESULT_BLOCKS] = {};	// by job id, nullptr until built
+	static sndOutput releasedOutput;		// marks a built id whose output release() has freed
+	atomic<unsigned int> submitted{ 0 };	// also the next id
+	atomic<unsigned int> completed{ 0 };
+	atomic<unsigned int> queuedJobs{ 0 };	// every tier, counted before it's pushed and after it's popped
+	atomic<unsigned int> urgentJobs{ 0 };
+	atomic<unsigned int> bulkJobs{ 0 };
+	atomic<unsigned int> spilledJobs{ 0 };
+	atomic<unsigned int> stealCount{ 0 };
+	atomic<unsigned int> spillCount{ 0 };
+	atomic<unsigned int> waiters{ 0 };		// threads in a wait(), finish() only notifies when there are some
+	mutex mutexResults;						// held to sleep on jobsDone
+	condition_variable jobsDone;			// wait() waits on it
+	mutex mutexUrgent;						// held to touch the urgent heap, urgent jobs are few so it's locked
+	vector<job> urgentHeap;					// shared by every worker, earliest deadline on top (then cheapest)
+	ringQueue<job> bulkRing{ SFXR_BULK_QUEUE };	// the normal tier is the workers' own rings
+	mutex mutexSpill;						// held to touch the spilled jobs, once a ring is full
+	deque<job> spilled[3];					// by priority
+
+	// the stats, times in microseconds
+	atomic<unsigned int> builtBy[3] = {};
+	atomic<unsigned int> deadlineCount{ 0 };
+	atomic<unsigned int> missCount{ 0 };
+	atomic<unsigned long long> worstLate{ 0 };
+	atomic<unsigned long long> worstWait[3] = {};
+
+	struct completion {
+		unsigned int id = 0;
+		sndOutput* pOut = nullptr;
+		callback done;
+	};
+	ringQueue<completion> drainQueue{ SFXR_DRAIN_QUEUE };
+	mutex mutexDrain;						// held to touch the spilled completions
+	deque<completion> drainSpilled;
+
+	atomic<sndOutput*>& resultSlot(unsigned int id);	// its block is made on first use
+	unsigned int reserve(unsigned int n);	// n new ids, the first
+	void enqueue(job& j);
+	void wake(size_t n);				// up to n sleeping workers
+	bool unspill(priority pri, job& j);	// the oldest spilled job of that tier
+	bool takeUrgent(threadSfxr* t, job& j);
+	bool take(threadSfxr* t, job& j);	// urgent, its own oldest, the oldest of the most loaded worker, then bulk
+	void start(job& j);					// a worker has it
+	void finish(job& j, sndOutput* pOut);
+	void schedule(job& j, priority pri, float deadlineMs, const callback& done, deliver on);	// the rest of it, then enqueue()
+	bool running();						// any worker still filling
+
+public:
 	vector<threadSfxr*> threadTable;
 
 	libSfxr(unsigned int threadCount, unsigned int mode = 0, Sfxr::ExportFormat _format = Sfxr::ExportFormat::PCM16);
+	~libSfxr();
+	libSfxr(const libSfxr&) = delete;
+	libSfxr& operator=(const libSfxr&) = delete;
+	void begin();	// every thread's begin() and end(), wait() also waits for every submitted job
+	void end();
+	void wait();
+
+	// submit to the library rather than a thread: each job goes to the worker with the least predicted work queued,
+	// and a worker that runs out steals the oldest of the most loaded, so no sharding by hand. Built once begin() is
+	// called. The id is the ticket for the sound, and done (if given) is called with it once it's built
+	unsigned int submit(const Sfxr::Parameters& p, callback done = nullptr, deliver on = deliver::DRAIN);
+	unsigned int submit(const char* str, unsigned int len = 0, callback done = nullptr, deliver on = deliver::DRAIN);	// a SF/SW record, copied
+	unsigned int submit(const Sfxr::Parameters* p, unsigned int n, callback done = nullptr, deliver on = deliver::DRAIN);	// the first id, costliest handed out first
+	// the same with a priority, and a deadline in ms from now if it's above 0 (samples * 1000 / rate for one in samples):
+	// a job with a deadline is queued as URGENT whatever priority is asked, a BULK one too (else it would only wait behind
+	// everything and miss it), and every deadline is counted in stats(). An URGENT job without one is due right away
+	unsigned int submit(const Sfxr::Parameters& p, priority pri, float deadlineMs = 0.0f, callback done = nullptr, deliver on = deliver::DRAIN);
+	unsigned int submit(const char* str, unsigned int len, priority pri, float deadlineMs = 0.0f, callback done = nullptr, deliver on = deliver::DRAIN);
+	unsigned int submit(const Sfxr::Parameters* p, unsigned int n, priority pri, float deadlineMs = 0.0f, callback done = nullptr, deliver on = deliver::DRAIN);
+	bool isDone(unsigned int id);			// still true once it's released
+	sndOutput* result(unsigned int id);		// nullptr until it's built (or once released), owned by the library
+	bool release(unsigned int id);			// free a built output, don't use it (or release before its callback) after, false if not built
+	sndOutput* wait(unsigned int id);		// blocks until that one is built, nullptr if every worker ends first
+	unsigned int drain();					// runs the deliver::DRAIN callbacks of the sounds built since the last drain(), how many
+	unsigned int steals();					// jobs taken from another worker's queue so far
+	unsigned int spills();					// jobs and completions that found their ring full and took a lock
+	schedStats stats();
+	void setCache(renderCache* c);	// every thread builds through it, it has to outlive them
+	void setCache(memoryCache* c);
 };
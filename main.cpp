@@ -1,7 +1,16 @@
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include "cppSfxr.h"
+#include "libSfxr.h"
 #include <chrono>
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+#include <atomic>
+#include <algorithm>
 
 using namespace std::chrono;
 using namespace std;
@@ -10,7 +19,7 @@ class Benchmark
 {
 public:
 	high_resolution_clock::time_point _start, _stop;
-	duration<double> time_span;
+	std::chrono::duration<double> time_span;
 
 	void start() { _start = high_resolution_clock::now(); }
 	void stop() { _stop = high_resolution_clock::now(); }
@@ -75,6 +84,63 @@ int main()
 	pSfxr->create(SFXR_BLIP_SELECT);
 	pSfxr->exportWaveFloatFile("snd_blip.wav");
 
+	std::cout << "\t *stream the blip/select sound 512 samples at a time, it should match the one we created!\n";
+	{
+		unsigned int n = pSfxr->size(Sfxr::ExportFormat::FLOAT) / sizeof(float);
+		vector<float> created(n), streamed(n + 512);
+		pSfxr->exportBuffer(Sfxr::ExportFormat::FLOAT, created.data());
+		size_t got = 0;
+		pSfxr->beginStream();
+		while (!pSfxr->isFinished())
+			got += pSfxr->renderInto(streamed.data() + got, 512);
+		bool same = (got == n);
+		for (size_t i = 0; same && i < n; i++)
+			same = (created[i] == streamed[i]);
+		std::cout << "\t *streamed " << got << " samples, " << (same ? "matches" : "DOES NOT MATCH") << " !\n";
+	}
+
+	std::cout << "\t *read the blip/select samples in place, they should match the float export too!\n";
+	{
+		Sfxr::SoundInfo info;
+		pSfxr->getInfo(info);
+		const float* samples = pSfxr->getSamples();
+		unsigned int n = pSfxr->sampleCount();
+		vector<float> created(n);
+		pSfxr->exportBuffer(Sfxr::ExportFormat::FLOAT, created.data());
+		bool same = (n == info.totalSamples);
+		for (unsigned int i = 0; same && i < n; i++)
+			same = (created[i] == samples[i]);
+		std::cout << "\t *" << n << " samples in " << info.memoryUsed << " bytes, " << (same ? "matches" : "DOES NOT MATCH") << " !\n";
+	}
+
+	std::cout << "\t *the blip/select limit, average and rms are kept while synthing, check them against a scan, then normalize it!\n";
+	{
+		Sfxr::SoundInfo info;
+		pSfxr->getInfo(info);
+		const float* samples = pSfxr->getSamples();
+		float limit = 0.0f;
+		double average = 0.0, squares = 0.0;
+		for (unsigned int i = 0; i < info.totalSamples; i++)
+		{
+			limit = max(limit, fabs(samples[i]));
+			average += fabs(samples[i]);
+			squares += (double)samples[i] * (double)samples[i];
+		}
+		average /= info.totalSamples;
+		double rms = sqrt(squares / info.totalSamples);
+		bool same = (limit == info.limit) && fabs(average - info.average) < 1e-6 * average && fabs(rms - info.rms) < 1e-6 * rms;
+		std::cout << "\t *limit " << info.limit << ", average " << info.average << ", rms " << info.rms << ", " << (same ? "matches" : "DOES NOT MATCH") << " !\n";
+		pSfxr->setMode(SFXR_NORMALIZE);
+		vector<int16_t> pcm(info.totalSamples);
+		pSfxr->exportBuffer(Sfxr::ExportFormat::PCM16, pcm.data());
+		int peak = 0;
+		for (int16_t x : pcm)
+			peak = max(peak, abs((int)x));
+		pSfxr->getInfo(info);
+		std::cout << "\t *normalized PCM16 peak " << peak << ", limit now " << info.limit << " !\n";
+		pSfxr->setMode(SFXR_PLAIN_MODE);
+	}
+
 	std::cout << "\t *now going to benchmark the sample generation speed!\n";
 	// **********************************************************************************************************
 	// benchmark!
@@ -165,6 +231,918 @@ int main()
 	std::cout << "\t *sounds per second: " << 7000.0 / totalTime << " sound/sec !\n";
 	std::cout << "\t *resultant seconds of samples per second: " << totalSamples / totalTime / 44100.0 << "x !\n";
 
+	std::cout << "\t *now going to benchmark batch rendering of the same kinds of sounds!\n";
+	// **********************************************************************************************************
+	// batch benchmark! SfxrBatch renders many sounds at once, should match rendering them one by one
+	vector<Sfxr::Parameters> batchParams;
+	for (int i = 0; i < 7000; i++)
+	{
+		pSfxr->create(i % 7);
+		batchParams.push_back(*pSfxr->getParameters());
+	}
+	SfxrBatch batch;
+	totalSamples = 0.0;
+	bench.start();
+	batch.render(batchParams.data(), (unsigned int)batchParams.size());
+	bench.stop();
+	for (unsigned int i = 0; i < batch.count(); i++)
+		totalSamples += (double)batch.size(i);
+	// every sound, sample for sample
+	int batchSame = 0;
+	vector<float> single;
+	for (unsigned int i = 0; i < batch.count(); i++)
+	{
+		pSfxr->setParameters(batchParams[i]);
+		pSfxr->create();
+		pSfxr->getInfo(Info);
+		single.resize(Info.totalSamples);
+		pSfxr->exportBuffer(Sfxr::ExportFormat::FLOAT, single.data());
+		if (Info.totalSamples == batch.size(i) && memcmp(single.data(), batch.getSamples(i), single.size() * sizeof(float)) == 0) batchSame++;
+	}
+	std::cout << "\t *batch matches single renders: " << batchSame << " of " << batch.count() << ", " << (batchSame == (int)batch.count() ? "ok" : "MISMATCH") << " !\n";
+	std::cout << "\t *time taken: " << bench.duration() << " seconds !\n";
+	std::cout << "\t *sounds per second: " << 7000.0 / bench.duration() << " sound/sec !\n";
+	std::cout << "\t *resultant seconds of samples per second: " << totalSamples / bench.duration() / 44100.0 << "x !\n";
+
+	std::cout << "\t *now going to check SFXR_FAST_MATH stays close to the reference on sine, tan and compressed sounds!\n";
+	// **********************************************************************************************************
+	// fast math: error power relative to the reference must stay under -40 dB for every sound
+	Sfxr* pFast = new Sfxr();
+	pFast->setMode(SFXR_FAST_MATH);
+	double worstError = -1000.0;
+	double refTime = 0.0, fastTime = 0.0;
+	for (int i = 0; i < 300; i++)
+	{
+		pSfxr->create(i % 7);
+		Sfxr::Parameters p = *pSfxr->getParameters();
+		p.vib_strength = 0.0f;		// vibrato is always exact, see cppSfxr.cpp
+		if (i % 3 == 0) p.wave_type = SFXR_WAVE_SINE;
+		if (i % 3 == 1) p.wave_type = SFXR_WAVE_TAN;
+		if (i % 3 == 2) p.cs_compress = 0.5f;
+		pSfxr->setParameters(p);
+		pFast->setParameters(p);
+		bench.start();
+		pSfxr->create();
+		bench.stop();
+		refTime += bench.duration();
+		bench.start();
+		pFast->create();
+		bench.stop();
+		fastTime += bench.duration();
+		unsigned int n = pSfxr->size(Sfxr::ExportFormat::FLOAT) / sizeof(float);
+		vector<float> ref(n), fast(n);
+		pSfxr->exportBuffer(Sfxr::ExportFormat::FLOAT, ref.data());
+		pFast->exportBuffer(Sfxr::ExportFormat::FLOAT, fast.data());
+		double error = 0.0, power = 0.0;
+		bool finite = true;
+		for (unsigned int j = 0; j < n; j++)
+		{
+			// a negative sample compressed is nan in both, skip those
+			if (ref[j] != ref[j]) continue;
+			float f = fast[j];
+			// a compressed sample right at a zero crossing can come out just under zero (so nan) in the fast path,
+			// count it as the 0 it was, anything else that isn't a number is a failure
+			if (!std::isfinite(f))
+			{
+				if (f != f && p.cs_compress != 0.0f && fabs(ref[j]) < 0.01f) f = 0.0f;
+				else finite = false;
+			}
+			error += (double)(ref[j] - f) * (double)(ref[j] - f);
+			power += (double)ref[j] * (double)ref[j];
+		}
+		// checked by hand, max() would quietly keep the old worst over a nan
+		double db = power > 0.0 ? 10.0 * log10(error / power + 1e-30) : -1000.0;
+		if (!finite || !std::isfinite(db)) db = INFINITY;
+		worstError = max(worstError, db);
+	}
+	delete pFast;
+	std::cout << "\t *worst error: " << worstError << " dB, " << (worstError < -40.0 ? "ok" : "TOO HIGH") << " !\n";
+	std::cout << "\t *reference time: " << refTime << " seconds, fast math time: " << fastTime << " seconds !\n";
+
+	std::cout << "\t *now going to export 1000 sounds as PCM16, through floats and with SFXR_DIRECT_PCM!\n";
+	{
+		// fresh ones, the presets build on whatever parameters were there before
+		Sfxr* pPlain = new Sfxr();
+		Sfxr* pDirect = new Sfxr();
+		pDirect->setMode(SFXR_DIRECT_PCM);
+		double floatTime = 0.0, directTime = 0.0;
+		bool same = true;
+		vector<char> a, b;
+		for (int i = 0; i < 1000; i++)
+		{
+			pPlain->seed(i);
+			pDirect->seed(i);
+			// same flow as LOVE's Sfxr:soundData(), create, get the size, export
+			bench.start();
+			pPlain->create(i % 7);
+			a.resize(pPlain->size(Sfxr::ExportFormat::PCM16));
+			pPlain->exportBuffer(Sfxr::ExportFormat::PCM16, a.data());
+			bench.stop();
+			floatTime += bench.duration();
+			bench.start();
+			pDirect->create(i % 7);
+			b.resize(pDirect->size(Sfxr::ExportFormat::PCM16));
+			pDirect->exportBuffer(Sfxr::ExportFormat::PCM16, b.data());
+			bench.stop();
+			directTime += bench.duration();
+			same = same && (a == b);
+		}
+		delete pPlain;
+		delete pDirect;
+		std::cout << "\t *direct output matches: " << (same ? "yes" : "NO") << " !\n";
+		std::cout << "\t *through floats: " << floatTime << " seconds, direct: " << directTime << " seconds !\n";
+	}
+
+	std::cout << "\t *now going to predict the length of 2000 sounds, then create them to check!\n";
+	{
+		Sfxr* pMaker = new Sfxr();
+		Sfxr* pCheck = new Sfxr();
+		vector<Sfxr::Parameters> params;
+		for (int i = 0; i < 2000; i++)
+		{
+			pMaker->seed(i);
+			pMaker->create(i % 7);
+			Sfxr::Parameters p = *pMaker->getParameters();
+			// and give some a frequency cutoff, with the slide, arpeggio and repeat that move it around
+			if (i % 3 == 0) { p.freq_limit = 0.2f; p.freq_ramp = -0.3f; }
+			if (i % 6 == 0) p.freq_dramp = 0.0f;
+			if (i % 9 == 0) { p.arp_speed = 0.7f; p.arp_mod = -0.4f; }
+			if (i % 15 == 0) p.repeat_speed = 0.6f;
+			params.push_back(p);
+		}
+		double predictTime = 0.0, createTime = 0.0;
+		int wrong = 0;
+		for (Sfxr::Parameters& p : params)
+		{
+			bench.start();
+			unsigned int predicted = pCheck->predictLength(p);
+			bench.stop();
+			predictTime += bench.duration();
+			bench.start();
+			pCheck->setParameters(p);
+			pCheck->create();
+			bench.stop();
+			createTime += bench.duration();
+			if (predicted != pCheck->sampleCount()) wrong++;
+		}
+		delete pMaker;
+		delete pCheck;
+		std::cout << "\t *predictions wrong: " << wrong << ", " << (wrong == 0 ? "ok" : "BAD") << " !\n";
+		std::cout << "\t *predict time: " << predictTime << " seconds, create time: " << createTime << " seconds !\n";
+	}
+
+	std::cout << "\t *now going to write a bank of 5000 presets to snd_bank.sfxb, map it and look each one up by name!\n";
+	{
+		libSfxr::soundBankWriter writer;
+		Sfxr* pMaker = new Sfxr();
+		char name[32];
+		for (int i = 0; i < 5000; i++)
+		{
+			pMaker->seed(i);
+			pMaker->create(i % 7);
+			pMaker->setVolume(0.25f + (i % 4) * 0.125f);
+			// some of them carry data
+			if (i % 10 == 0) pMaker->setData(name, 16, true);
+			else pMaker->setData(nullptr, 0);
+			snprintf(name, sizeof(name), "preset_%d", i);
+			writer.add(name, *pMaker);
+		}
+		bench.start();
+		bool written = writer.writeFile("snd_bank.sfxb");
+		bench.stop();
+		double writeTime = bench.duration();
+
+		libSfxr::soundBank bank;
+		bench.start();
+		bool opened = bank.open("snd_bank.sfxb");
+		int found = 0;
+		for (int i = 0; i < 5000; i++)
+		{
+			snprintf(name, sizeof(name), "preset_%d", i);
+			if (bank.find(name) == i) found++;
+		}
+		bench.stop();
+		double lookupTime = bench.duration();
+
+		// entries come back as they went in, and make the same sound as the preset did
+		bool same = opened && bank.count() == 5000 && bank.find("no_such_preset") == -1;
+		Sfxr* pBanked = new Sfxr();
+		for (int i = 0; i < 5000 && same; i += 499)
+		{
+			pMaker->seed(i);
+			pMaker->create(i % 7);
+			pMaker->setVolume(0.25f + (i % 4) * 0.125f);
+			bank.apply(i, *pBanked);
+			unsigned int size = 0;
+			bank.data(i, &size);
+			same = memcmp(bank.parameters(i), pMaker->getParameters(), sizeof(Sfxr::Parameters)) == 0 && size == (i % 10 == 0 ? 16u : 0u);
+			same = same && pBanked->sampleCount() == pMaker->sampleCount() && memcmp(pBanked->getSamples(), pMaker->getSamples(), pMaker->sampleCount() * sizeof(float)) == 0;
+		}
+		delete pBanked;
+		delete pMaker;
+		std::cout << "\t *written: " << (written ? "yes" : "NO") << ", found by name: " << found << ", entries match: " << (same ? "yes" : "NO") << " !\n";
+		std::cout << "\t *write time: " << writeTime << " seconds, open and 5000 lookups: " << lookupTime << " seconds !\n";
+	}
+
+	std::cout << "\t *now going to render 500 presets as PCM16 through the disk cache in snd_cache, cold then warm!\n";
+	{
+		std::filesystem::remove_all("snd_cache");
+		libSfxr::renderCache cache("snd_cache");
+		Sfxr* pCached = new Sfxr();
+		vector<vector<char>> cold(500);
+		vector<Sfxr::Parameters> params(500);
+		bench.start();
+		for (int i = 0; i < 500; i++)
+		{
+			pCached->seed(i);
+			pCached->create(i % 7);
+			params[i] = *pCached->getParameters();
+			cold[i].resize(cache.size(*pCached, Sfxr::ExportFormat::PCM16));
+			cache.exportBuffer(*pCached, Sfxr::ExportFormat::PCM16, cold[i].data());
+		}
+		bench.stop();
+		double coldTime = bench.duration();
+		int same = 0;
+		vector<char> warm;
+		Sfxr::SoundQuickInfo info;
+		bench.start();
+		for (int i = 0; i < 500; i++)
+		{
+			// a hit never synths, so only the parameters are needed
+			pCached->setParameters(params[i]);
+			warm.resize(cache.size(*pCached, Sfxr::ExportFormat::PCM16));
+			cache.exportBuffer(*pCached, Sfxr::ExportFormat::PCM16, warm.data(), &info);
+			if (warm == cold[i] && info.totalSamples * 2 == warm.size()) same++;
+		}
+		bench.stop();
+		double warmTime = bench.duration();
+		delete pCached;
+		std::cout << "\t *hits: " << cache.hits() << ", misses: " << cache.misses() << ", warm matches cold: " << same << " of 500 !\n";
+		std::cout << "\t *cold time: " << coldTime << " seconds, warm time: " << warmTime << " seconds !\n";
+	}
+
+	std::cout << "\t *now going to play 100 presets 10 times over on 4 threads through a 16MB memory cache!\n";
+	{
+		libSfxr::memoryCache memory(16 << 20);
+		vector<Sfxr::Parameters> params(100);
+		vector<vector<char>> direct(100);
+		Sfxr* pDirect = new Sfxr();
+		bench.start();
+		for (int i = 0; i < 100; i++)
+		{
+			pDirect->seed(i);
+			pDirect->create(i % 7);
+			params[i] = *pDirect->getParameters();
+			direct[i].resize(pDirect->size(Sfxr::ExportFormat::PCM16));
+			pDirect->exportBuffer(Sfxr::ExportFormat::PCM16, direct[i].data());
+		}
+		bench.stop();
+		double directTime = bench.duration();
+		delete pDirect;
+		atomic<int> wrong{ 0 };
+		bench.start();
+		vector<thread> players;
+		for (int t = 0; t < 4; t++)
+			players.emplace_back([&, t]() {
+				Sfxr s;
+				for (int round = 0; round < 10; round++)
+					for (int i = 0; i < 100; i++)
+					{
+						int n = (i + t * 25) % 100;
+						s.setParameters(params[n]);
+						libSfxr::memoryCache::handle h = memory.get(s, Sfxr::ExportFormat::PCM16);
+						if (h->sample != direct[n]) wrong++;
+					}
+			});
+		for (thread& t : players) t.join();
+		bench.stop();
+		size_t all = memory.bytes();
+		std::cout << "\t *hits: " << memory.hits() << ", misses: " << memory.misses() << ", wrong: " << wrong << ", holding " << memory.count() << " sounds in " << all << " bytes !\n";
+		std::cout << "\t *100 renders: " << directTime << " seconds, 4000 plays through the cache: " << bench.duration() << " seconds !\n";
+		memory.setBudget(all / 4);
+		std::cout << "\t *budget cut to a quarter: " << memory.evictions() << " evicted, holding " << memory.count() << " sounds in " << memory.bytes() << " bytes !\n";
+	}
+
+	std::cout << "\t *now going to pack 1000 SF records in memory, then load them 100 times over from the buffer and through a stream!\n";
+	{
+		Sfxr* pWriter = new Sfxr();
+		vector<char> archive;
+		vector<size_t> offsets;
+		vector<Sfxr::Parameters> params(1000);
+		char tag[24] = "attached to the record";
+		for (int i = 0; i < 1000; i++)
+		{
+			pWriter->seed(i);
+			pWriter->create(i % 7);
+			params[i] = *pWriter->getParameters();
+			pWriter->setVolume(0.25f + (i % 4) * 0.125f);
+			if (i % 10 == 0) pWriter->setData(tag, sizeof(tag), true);
+			else pWriter->setData(nullptr, 0);
+			offsets.push_back(archive.size());
+			archive.resize(archive.size() + pWriter->writeSize());
+			pWriter->writeBuffer(archive.data() + offsets.back(), pWriter->writeSize());
+		}
+		offsets.push_back(archive.size());
+		// each record checked, attached data is used in place
+		Sfxr* pReader = new Sfxr();
+		int good = 0;
+		for (int i = 0; i < 1000; i++)
+		{
+			const char* record = archive.data() + offsets[i];
+			size_t size = offsets[i + 1] - offsets[i];
+			bool ok = pReader->loadBuffer(record, size, false) && !pReader->loadBuffer(record, size - 1, false);
+			ok = ok && pReader->loadBuffer(record, size, false);
+			ok = ok && memcmp(pReader->getParameters(), &params[i], sizeof(Sfxr::Parameters)) == 0 && pReader->getVolume() == 0.25f + (i % 4) * 0.125f;
+			ok = ok && (i % 10 == 0 ? pReader->getData() == record + 144 && pReader->getDataSize() == sizeof(tag) : pReader->getData() == nullptr);
+			if (ok) good++;
+		}
+		pReader->setData(nullptr, 0);
+		bench.start();
+		for (int r = 0; r < 100; r++)
+			for (int i = 0; i < 1000; i++)
+				pReader->loadBuffer(archive.data() + offsets[i], offsets[i + 1] - offsets[i], false);
+		bench.stop();
+		double bufferTime = bench.duration();
+		std::string packed(archive.data(), archive.size());
+		bench.start();
+		for (int r = 0; r < 100; r++)
+		{
+			std::istringstream iss(packed);
+			for (int i = 0; i < 1000; i++)
+				pReader->loadStream(iss);
+		}
+		bench.stop();
+		double streamTime = bench.duration();
+		// and the files and word mode records make it back too
+		pWriter->writeFile("snd_record.sf");
+		bool fileOk = pReader->loadFile("snd_record.sf") && memcmp(pReader->getParameters(), pWriter->getParameters(), sizeof(Sfxr::Parameters)) == 0;
+		pWriter->setMode(SFXR_WORD_MODE);
+		pReader->setMode(SFXR_WORD_MODE);
+		pWriter->create(SFXR_EXPLOSION);
+		vector<char> word(pWriter->writeSize());
+		bool wordOk = pWriter->writeString(word.data()) && pReader->loadString(word.data());
+		wordOk = wordOk && memcmp(pReader->getParameters(), pWriter->getParameters(), sizeof(Sfxr::Parameters)) == 0;
+		delete pReader;
+		delete pWriter;
+		std::cout << "\t *records loaded back right: " << good << " of 1000, file: " << (fileOk ? "yes" : "NO") << ", word mode: " << (wordOk ? "yes" : "NO") << " !\n";
+		std::cout << "\t *100000 loads from the buffer: " << bufferTime << " seconds, from a stream: " << streamTime << " seconds !\n";
+	}
+
+	std::cout << "\t *now going to load a lazy bank of 2000 presets, prefetch 100 and play 200 of them!\n";
+	{
+		vector<Sfxr::Parameters> params(2000);
+		Sfxr* pMaker = new Sfxr();
+		for (int i = 0; i < 2000; i++)
+		{
+			pMaker->seed(i);
+			pMaker->create(i % 7);
+			params[i] = *pMaker->getParameters();
+		}
+		bench.start();
+		libSfxr::lazyBank lazy(4);
+		for (int i = 0; i < 2000; i++)
+			lazy.add(params[i]);
+		bench.stop();
+		double startTime = bench.duration();
+		// the level's first sounds are hinted, then played in order, waiting on any that aren't there yet
+		unsigned int hinted[100];
+		for (int i = 0; i < 100; i++) hinted[i] = i * 20;
+		lazy.prefetch(hinted, 100);
+		int ready = 0, wrong = 0;
+		bench.start();
+		for (int i = 0; i < 200; i++)
+		{
+			unsigned int id = (i * 20) % 2000 + (i >= 100 ? 1 : 0);
+			libSfxr::lazyBank::handle snd;
+			if (lazy.get(id, snd)) ready++;
+			else snd = lazy.wait(id);
+			if (i % 10 == 0)
+			{
+				pMaker->setParameters(params[id]);
+				pMaker->setVolume(0.5f);
+				pMaker->create();
+				vector<char> direct(pMaker->size(Sfxr::ExportFormat::PCM16));
+				pMaker->exportBuffer(Sfxr::ExportFormat::PCM16, direct.data());
+				if (direct != snd->sample) wrong++;
+			}
+		}
+		bench.stop();
+		delete pMaker;
+		std::cout << "\t *ready when asked: " << ready << " of 200, rendered " << lazy.rendered() << " of 2000, wrong: " << wrong << " !\n";
+		std::cout << "\t *start: " << startTime << " seconds, playing 200: " << bench.duration() << " seconds !\n";
+	}
+
+	std::cout << "\t *now going to make 64 PCM16 variants of each kind one by one, then with createBatch() on 1 and 4 threads!\n";
+	{
+		unsigned long long seeds[64];
+		for (int i = 0; i < 64; i++) seeds[i] = 1000 + i * 7919;
+		Sfxr* pMaker = new Sfxr();
+		vector<char> single;
+		bench.start();
+		for (int what = 0; what < 7; what++)
+			for (int i = 0; i < 64; i++)
+			{
+				pMaker->seed(seeds[i]);
+				pMaker->create(what);
+				size_t at = single.size();
+				single.resize(at + pMaker->size(Sfxr::ExportFormat::PCM16));
+				pMaker->exportBuffer(Sfxr::ExportFormat::PCM16, single.data() + at);
+			}
+		bench.stop();
+		double singleTime = bench.duration();
+		double batchTime[2];
+		bool same[2];
+		for (int run = 0; run < 2; run++)
+		{
+			vector<char> packed;
+			size_t offsets[65];
+			bench.start();
+			for (int what = 0; what < 7; what++)
+			{
+				size_t at = packed.size();
+				packed.resize(at + pMaker->createBatch(what, seeds, 64, Sfxr::ExportFormat::PCM16, nullptr, offsets));
+				pMaker->createBatch(what, seeds, 64, Sfxr::ExportFormat::PCM16, packed.data() + at, offsets, run == 0 ? 1 : 4);
+			}
+			bench.stop();
+			batchTime[run] = bench.duration();
+			same[run] = packed == single;
+		}
+		delete pMaker;
+		std::cout << "\t *batches match: " << (same[0] ? "yes" : "NO") << ", " << (same[1] ? "yes" : "NO") << " !\n";
+		std::cout << "\t *one by one: " << singleTime << " seconds, batched: " << batchTime[0] << " seconds, on 4 threads: " << batchTime[1] << " seconds !\n";
+	}
+
+	std::cout << "\t *now going to make 256 keyed sounds in order and shuffled over 4 threads, and render pink noise twice!\n";
+	{
+		// each sound is keyed by (seed, index), so it can't matter which thread made it, or what it made before
+		vector<Sfxr::Parameters> ordered(256), shuffled(256);
+		Sfxr* pMaker = new Sfxr();
+		for (unsigned int i = 0; i < 256; i++)
+		{
+			pMaker->seed(42, i);
+			pMaker->create((int)(i % 7));
+			ordered[i] = *pMaker->getParameters();
+		}
+		vector<thread> makers;
+		for (unsigned int t = 0; t < 4; t++)
+			makers.emplace_back([&shuffled, t]() {
+				Sfxr s;
+				for (unsigned int n = 0; n < 64; n++)
+				{
+					unsigned int i = (n * 4 + t) * 97 % 256;
+					s.randomize();	// draws in between don't matter either
+					s.seed(42, i);
+					s.create((int)(i % 7));
+					shuffled[i] = *s.getParameters();
+				}
+			});
+		for (thread& t : makers) t.join();
+		int same = 0, apart = 0;
+		for (unsigned int i = 0; i < 256; i++)
+		{
+			if (memcmp(&ordered[i], &shuffled[i], sizeof(Sfxr::Parameters)) == 0) same++;
+			if (i >= 7 && memcmp(&ordered[i], &ordered[i - 7], sizeof(Sfxr::Parameters)) != 0) apart++;
+		}
+		// pink noise starts over each render, like the other noise
+		pMaker->create(SFXR_EXPLOSION);
+		pMaker->getParameters()->wave_type = (float)SFXR_WAVE_PINK;
+		pMaker->create();
+		vector<float> first(pMaker->getSamples(), pMaker->getSamples() + pMaker->sampleCount());
+		pMaker->create();
+		bool pinkSame = first.size() == pMaker->sampleCount() && memcmp(first.data(), pMaker->getSamples(), first.size() * sizeof(float)) == 0;
+		// string seeds longer than 4 chars work, and chars 5 to 8 count
+		pMaker->seed("blast_01");
+		pMaker->create(SFXR_EXPLOSION);
+		Sfxr::Parameters a = *pMaker->getParameters();
+		pMaker->seed("blast_02");
+		pMaker->create(SFXR_EXPLOSION);
+		bool stringsApart = memcmp(&a, pMaker->getParameters(), sizeof(Sfxr::Parameters)) != 0;
+		delete pMaker;
+		std::cout << "\t *keyed sounds the same either way: " << same << " of 256, each unlike the last of its kind: " << apart << " of 249 !\n";
+		std::cout << "\t *pink noise renders the same twice: " << (pinkSame ? "yes" : "NO") << ", long string seeds differ: " << (stringsApart ? "yes" : "NO") << " !\n";
+	}
+
+	std::cout << "\t *now going to render 400 high pitched white and pink noise sounds, one by one and batched!\n";
+	{
+		// high pitched noise wraps its period the most, each wrap a step to the next block of the shared noise tables
+		vector<Sfxr::Parameters> noisy(400);
+		Sfxr* pNoise = new Sfxr();
+		for (int i = 0; i < 400; i++)
+		{
+			pNoise->seed(i);
+			pNoise->create(i % 2 ? SFXR_EXPLOSION : SFXR_HIT_HURT);
+			noisy[i] = *pNoise->getParameters();
+			noisy[i].wave_type = (float)(i % 4 ? SFXR_WAVE_NOISE : SFXR_WAVE_PINK);
+			noisy[i].base_freq = 0.6f + (i % 5) * 0.1f;
+		}
+		double samples = 0.0;
+		bench.start();
+		for (int i = 0; i < 400; i++)
+		{
+			pNoise->setParameters(noisy[i]);
+			pNoise->create();
+			samples += pNoise->sampleCount();
+		}
+		bench.stop();
+		SfxrBatch noiseBatch;
+		noiseBatch.render(noisy.data(), 400);
+		int same = 0;
+		for (int i = 0; i < 400; i++)
+		{
+			pNoise->setParameters(noisy[i]);
+			pNoise->create();
+			if (pNoise->sampleCount() == noiseBatch.size(i) && memcmp(pNoise->getSamples(), noiseBatch.getSamples(i), noiseBatch.size(i) * sizeof(float)) == 0) same++;
+		}
+		delete pNoise;
+		std::cout << "\t *batched matches one by one: " << same << " of 400, " << (same == 400 ? "ok" : "MISMATCH") << ", " << (samples / bench.duration() / 1000000.0) << " million samples/sec !\n";
+	}
+
+	std::cout << "\t *now going to render 300 fast repeating, arpeggiated sounds whole and streamed 37 samples at a time!\n";
+	{
+		// short repeats and arpeggios put an event every few dozen samples, so the odd stream pieces cut runs all over
+		vector<Sfxr::Parameters> busy(300);
+		Sfxr* pBusy = new Sfxr();
+		for (int i = 0; i < 300; i++)
+		{
+			pBusy->seed(i);
+			pBusy->create(i % 7);
+			busy[i] = *pBusy->getParameters();
+			busy[i].repeat_speed = 0.8f + (i % 4) * 0.05f;
+			busy[i].arp_speed = 0.7f + (i % 3) * 0.1f;
+			busy[i].arp_mod = (i % 2) ? 0.5f : -0.5f;
+		}
+		double samples = 0.0;
+		bench.start();
+		for (int i = 0; i < 300; i++)
+		{
+			pBusy->setParameters(busy[i]);
+			pBusy->create();
+			samples += pBusy->sampleCount();
+		}
+		bench.stop();
+		int same = 0;
+		vector<float> streamed;
+		for (int i = 0; i < 300; i++)
+		{
+			pBusy->setParameters(busy[i]);
+			pBusy->create();
+			vector<float> created(pBusy->getSamples(), pBusy->getSamples() + pBusy->sampleCount());
+			streamed.assign(created.size() + 37, 0.0f);
+			size_t got = 0;
+			pBusy->beginStream();
+			while (!pBusy->isFinished() && got + 37 <= streamed.size())
+				got += pBusy->renderInto(streamed.data() + got, 37);
+			if (got == created.size() && memcmp(created.data(), streamed.data(), got * sizeof(float)) == 0) same++;
+		}
+		delete pBusy;
+		std::cout << "\t *streamed matches whole: " << same << " of 300, " << (samples / bench.duration() / 1000000.0) << " million samples/sec !\n";
+	}
+
+	std::cout << "\t *now going to compare SFXR_CONTROL_RATE with the reference on 300 presets, with vibrato and filter sweeps!\n";
+	{
+		// same length always (the control path is exact), the error power relative to the reference should stay under -40 dB
+		Sfxr* pRef = new Sfxr();
+		Sfxr* pControl = new Sfxr();
+		pControl->setMode(SFXR_CONTROL_RATE);
+		vector<double> errors;
+		double refTime = 0.0, controlTime = 0.0;
+		int lengths = 0;
+		for (int i = 0; i < 300; i++)
+		{
+			pRef->seed(i);
+			pRef->create(i % 7);
+			Sfxr::Parameters p = *pRef->getParameters();
+			if (i % 2 == 0) { p.vib_strength = 0.3f; p.vib_speed = 0.4f; }
+			if (i % 3 == 0) { p.lpf_freq = 0.6f; p.lpf_ramp = 0.1f; p.hpf_freq = 0.05f; p.hpf_ramp = 0.1f; }
+			pRef->setParameters(p);
+			pControl->setParameters(p);
+			bench.start();
+			pRef->create();
+			bench.stop();
+			refTime += bench.duration();
+			bench.start();
+			pControl->create();
+			bench.stop();
+			controlTime += bench.duration();
+			if (pRef->sampleCount() != pControl->sampleCount()) continue;
+			lengths++;
+			const float* ref = pRef->getSamples();
+			const float* control = pControl->getSamples();
+			double error = 0.0, power = 0.0;
+			for (unsigned int j = 0; j < pRef->sampleCount(); j++)
+			{
+				if (ref[j] != ref[j]) continue;
+				error += (double)(ref[j] - control[j]) * (double)(ref[j] - control[j]);
+				power += (double)ref[j] * (double)ref[j];
+			}
+			if (power > 0.0)
+				errors.push_back(10.0 * log10(error / power + 1e-30));
+		}
+		delete pRef;
+		delete pControl;
+		sort(errors.begin(), errors.end());
+		std::cout << "\t *same length: " << lengths << " of 300, error median " << errors[errors.size() / 2] << " dB, worst " << errors.back() << " dB, " << (errors.back() < -40.0 ? "ok" : "TOO HIGH") << " !\n";
+		std::cout << "\t *reference time: " << refTime << " seconds, control rate time: " << controlTime << " seconds !\n";
+	}
+
+	std::cout << "\t *now going to build 400 presets on 4 library threads, then leave them idle for half a second!\n";
+	{
+		// the workers sleep when there's nothing to build, so idle they should use next to no cpu
+		libSfxr* pLib = new libSfxr(4);
+		Sfxr* pMaker = new Sfxr();
+		pLib->begin();
+		bench.start();
+		for (int i = 0; i < 400; i++)
+		{
+			pMaker->seed(i);
+			pMaker->create(i % 7);
+			pLib->threadTable[i % 4]->push(*pMaker->getParameters());
+		}
+		pLib->wait();
+		bench.stop();
+		int built = 0;
+		for (libSfxr::threadSfxr* t : pLib->threadTable)
+			built += t->getBuilding();
+		clock_t idleStart = clock();
+		this_thread::sleep_for(milliseconds(500));
+		double idleCpu = (double)(clock() - idleStart) / CLOCKS_PER_SEC;
+		// a push after the idle wakes its worker again
+		pLib->threadTable[0]->push(*pMaker->getParameters());
+		pLib->wait();
+		built += (pLib->threadTable[0]->getBuilding() == 101) ? 1 : 0;
+		delete pMaker;
+		delete pLib;	// ends and joins the workers
+		std::cout << "\t *built " << built << " of 401 in " << bench.duration() << " seconds, idle cpu " << idleCpu * 1000.0 << " ms over 500 ms !\n";
+	}
+
+	std::cout << "\t *now going to build 400 sounds with every long one on the same thread, sharded by hand and then submitted!\n";
+	{
+		// every 8th is a long explosion, which sharding i % 4 puts all on thread 0, submitted they're spread and stolen
+		vector<Sfxr::Parameters> skewed(400);
+		Sfxr* pMaker = new Sfxr();
+		for (int i = 0; i < 400; i++)
+		{
+			pMaker->seed(i);
+			pMaker->create(i % 8 == 0 ? SFXR_EXPLOSION : SFXR_BLIP_SELECT);
+			skewed[i] = *pMaker->getParameters();
+			if (i % 8 == 0) skewed[i].env_sustain = 0.6f;
+		}
+		libSfxr* pSharded = new libSfxr(4);
+		bench.start();
+		pSharded->begin();
+		for (int i = 0; i < 400; i++)
+			pSharded->threadTable[i % 4]->push(skewed[i]);
+		pSharded->wait();
+		bench.stop();
+		double shardedTime = bench.duration();
+		delete pSharded;
+		libSfxr* pPool = new libSfxr(4);
+		bench.start();
+		pPool->begin();
+		unsigned int first = pPool->submit(skewed.data(), 400);
+		pPool->wait();
+		bench.stop();
+		int same = 0;
+		for (int i = 0; i < 400; i++)
+		{
+			libSfxr::sndOutput* pOut = pPool->result(first + i);
+			pMaker->setParameters(skewed[i]);
+			pMaker->create();
+			vector<char> pcm(pMaker->size(Sfxr::ExportFormat::PCM16));
+			pMaker->exportBuffer(Sfxr::ExportFormat::PCM16, pcm.data());
+			if (pOut != nullptr && pOut->sampleBytes == pcm.size() && memcmp(pOut->pSample, pcm.data(), pcm.size()) == 0) same++;
+		}
+		// each output can be freed as soon as it's used, rather than all kept until the library goes
+		int released = 0;
+		for (int i = 0; i < 400; i++)
+			if (pPool->release(first + i) && !pPool->release(first + i) && pPool->isDone(first + i) && pPool->result(first + i) == nullptr) released++;
+		std::cout << "\t *submitted builds match: " << same << " of 400, " << pPool->steals() << " stolen, " << released << " released !\n";
+		std::cout << "\t *sharded time: " << shardedTime << " seconds, submitted time: " << bench.duration() << " seconds !\n";
+		delete pPool;
+		delete pMaker;
+	}
+
+	std::cout << "\t *now going to submit 200 presets with callbacks, half drained here and half run on the workers!\n";
+	{
+		libSfxr* pLib = new libSfxr(4);
+		Sfxr* pMaker = new Sfxr();
+		vector<Sfxr::Parameters> presets(200);
+		for (int i = 0; i < 200; i++)
+		{
+			pMaker->seed(i);
+			pMaker->create(i % 7);
+			presets[i] = *pMaker->getParameters();
+		}
+		std::atomic<int> onWorker(0);
+		int drained = 0, inOrder = 0;
+		bench.start();
+		pLib->begin();
+		unsigned int first = pLib->submit(presets.data(), 100, [&](unsigned int id, libSfxr::sndOutput* pOut) {
+			if (pOut != nullptr && pOut == pLib->result(id)) drained++;
+		});
+		for (int i = 100; i < 200; i++)
+			pLib->submit(presets[i], [&](unsigned int, libSfxr::sndOutput* pOut) {
+				if (pOut != nullptr) onWorker++;
+			}, libSfxr::deliver::WORKER);
+		// a handle can be waited on alone, before the rest are done
+		libSfxr::sndOutput* pLast = pLib->wait(first + 199);
+		while (drained < 100)
+		{
+			pLib->wait();
+			pLib->drain();
+		}
+		// worker callbacks run just after their result is set, so wait() can return a moment before them
+		while (onWorker < 100) std::this_thread::yield();
+		bench.stop();
+		// a thread push() ticket works the same way
+		unsigned int ticket = pLib->threadTable[0]->push(presets[0]);
+		libSfxr::sndOutput* pTicket = pLib->threadTable[0]->waitOutput(ticket);
+		inOrder = (pTicket != nullptr && pTicket == pLib->threadTable[0]->getOutput(ticket) && pTicket->sampleBytes == pLib->result(first)->sampleBytes) ? 1 : 0;
+		std::cout << "\t *drained " << drained << " and " << onWorker.load() << " on workers of 200, last handle " << (pLast != nullptr ? "ready" : "missing") << ", ticket " << (inOrder ? "ok" : "bad") << " in " << bench.duration() << " seconds !\n";
+		delete pMaker;
+		delete pLib;
+	}
+
+	std::cout << "\t *now going to submit 4000 sounds from 4 threads at once while 4 workers build, timing each submit, then push them to the threads instead!\n";
+	{
+		vector<Sfxr::Parameters> presets(4000);
+		Sfxr* pMaker = new Sfxr();
+		for (int i = 0; i < 4000; i++)
+		{
+			pMaker->seed(i);
+			pMaker->create(i % 7);
+			presets[i] = *pMaker->getParameters();
+		}
+		delete pMaker;
+		for (int pass = 0; pass < 2; pass++)
+		{
+			// submit() goes through the lock free rings, threadSfxr::push() takes the thread's lock
+			libSfxr* pLib = new libSfxr(4);
+			pLib->begin();
+			vector<vector<double>> latency(4);
+			vector<thread> producers;
+			for (int p = 0; p < 4; p++)
+				producers.push_back(thread([&, p]() {
+					latency[p].reserve(1000);
+					for (int i = p; i < 4000; i += 4)
+					{
+						auto t0 = std::chrono::steady_clock::now();
+						if (pass == 0) pLib->submit(presets[i]);
+						else pLib->threadTable[p]->push(presets[i]);
+						latency[p].push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count());
+					}
+				}));
+			for (thread& t : producers) t.join();
+			pLib->wait();
+			vector<double> all;
+			for (vector<double>& l : latency) all.insert(all.end(), l.begin(), l.end());
+			sort(all.begin(), all.end());
+			std::cout << "\t *" << (pass == 0 ? "submit()" : "push()") << " latency p50 " << all[all.size() / 2] << " us, p99 " << all[all.size() * 99 / 100] << " us, max " << all.back() << " us";
+			if (pass == 0) std::cout << ", " << pLib->spills() << " spilled";
+			std::cout << " !\n";
+			delete pLib;
+		}
+	}
+
+	std::cout << "\t *now going to prerender a 400 sound bank while 30 sounds are needed within a frame, as bulk and urgent and then all in order!\n";
+	{
+		vector<Sfxr::Parameters> bank(400), frame(30);
+		Sfxr* pMaker = new Sfxr();
+		for (int i = 0; i < 400; i++)
+		{
+			pMaker->seed(i);
+			pMaker->create(SFXR_EXPLOSION);
+			bank[i] = *pMaker->getParameters();
+			bank[i].env_sustain = 0.4f;
+		}
+		for (int i = 0; i < 30; i++)
+		{
+			pMaker->seed(1000 + i);
+			pMaker->create(SFXR_PICKUP_COIN);
+			frame[i] = *pMaker->getParameters();
+		}
+		delete pMaker;
+		for (int pass = 0; pass < 2; pass++)
+		{
+			// pass 0 gives the bank BULK and each frame sound a 16 ms deadline, pass 1 submits everything plainly (first in, first out)
+			libSfxr* pLib = new libSfxr(4);
+			pLib->begin();
+			bench.start();
+			if (pass == 0) pLib->submit(bank.data(), 400, libSfxr::priority::BULK);
+			else pLib->submit(bank.data(), 400);
+			vector<double> late(30, 0.0);
+			std::atomic<int> ready(0);
+			for (int i = 0; i < 30; i++)
+			{
+				this_thread::sleep_for(milliseconds(2));
+				auto due = std::chrono::steady_clock::now() + milliseconds(16);
+				libSfxr::callback done = [&, i, due](unsigned int, libSfxr::sndOutput*) {
+					late[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - due).count();
+					ready++;
+				};
+				if (pass == 0) pLib->submit(frame[i], libSfxr::priority::NORMAL, 16.0f, done, libSfxr::deliver::WORKER);
+				else pLib->submit(frame[i], done, libSfxr::deliver::WORKER);
+			}
+			while (ready < 30) this_thread::yield();
+			pLib->wait();
+			bench.stop();
+			int missed = 0;
+			double worst = late[0];
+			for (double l : late)
+			{
+				if (l > 0.0) missed++;
+				worst = std::max(worst, l);
+			}
+			std::cout << "\t *" << (pass == 0 ? "with deadlines" : "in order") << ": " << missed << " of 30 missed, the latest " << worst << " ms past its deadline, bank built in " << bench.duration() << " seconds !\n";
+			if (pass == 0)
+			{
+				libSfxr::schedStats st = pLib->stats();
+				std::cout << "\t *stats: built " << st.built[0] << " urgent, " << st.built[1] << " normal, " << st.built[2] << " bulk, " << st.missed << " of " << st.deadlines << " deadlines missed, longest urgent wait " << st.worstWaitMs[0] << " ms !\n";
+			}
+			delete pLib;
+		}
+		// mixed deadlines: 10 long sounds due in 250 ms queued just before 10 short ones due in 12 ms, all behind the bank
+		libSfxr* pLib = new libSfxr(4);
+		pLib->begin();
+		pLib->submit(bank.data(), 400, libSfxr::priority::BULK);
+		this_thread::sleep_for(milliseconds(5));
+		vector<double> late(20, 0.0);
+		std::atomic<int> ready(0);
+		for (int i = 0; i < 20; i++)
+		{
+			float due = i < 10 ? 250.0f : 12.0f;
+			auto at = std::chrono::steady_clock::now() + std::chrono::microseconds((long long)(due * 1000.0f));
+			libSfxr::callback done = [&, i, at](unsigned int, libSfxr::sndOutput*) {
+				late[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - at).count();
+				ready++;
+			};
+			pLib->submit(i < 10 ? bank[i] : frame[i], libSfxr::priority::URGENT, due, done, libSfxr::deliver::WORKER);
+		}
+		while (ready < 20) this_thread::yield();
+		int missedLong = 0, missedShort = 0;
+		for (int i = 0; i < 20; i++)
+			if (late[i] > 0.0) (i < 10 ? missedLong : missedShort)++;
+		std::cout << "\t *mixed deadlines: " << missedShort << " of 10 short ones and " << missedLong << " of 10 long ones missed, earliest deadline first !\n";
+		delete pLib;
+	}
+
+	std::cout << "\t *now going to benchmark export conversion, each format of a long sound 200 times!\n";
+	{
+		Sfxr* pLong = new Sfxr();
+		pLong->create(SFXR_EXPLOSION);
+		(*pLong)[SFXRI_ENV_SUSTAIN] = 1.0f;
+		(*pLong)[SFXRI_ENV_DECAY] = 1.0f;
+		pLong->create();
+		unsigned int n = pLong->size(Sfxr::ExportFormat::FLOAT) / sizeof(float);
+		vector<char> out(n * 4);
+		const char* names[5] = { "PCM8", "PCM16", "PCM24", "PCM32", "FLOAT" };
+		Sfxr::ExportFormat formats[5] = { Sfxr::ExportFormat::PCM8, Sfxr::ExportFormat::PCM16, Sfxr::ExportFormat::PCM24, Sfxr::ExportFormat::PCM32, Sfxr::ExportFormat::FLOAT };
+		for (int f = 0; f < 5; f++)
+		{
+			bench.start();
+			for (int i = 0; i < 200; i++)
+				pLong->exportBuffer(formats[f], out.data());
+			bench.stop();
+			std::cout << "\t *" << names[f] << ": " << (200.0 * n / bench.duration() / 1000000.0) << " million samples/sec !\n";
+		}
+		// dithered PCM16 rounds to nearest with TPDF noise: within 2 LSB of the exact value and unbiased on average
+		const float* samples = pLong->getSamples();
+		pLong->setMode(SFXR_DITHER);
+		pLong->exportBuffer(Sfxr::ExportFormat::PCM16, out.data());
+		const int16_t* pcm = (const int16_t*)out.data();
+		double worst = 0.0, bias = 0.0;
+		for (unsigned int i = 0; i < n; i++)
+		{
+			double e = (double)pcm[i] - (double)samples[i] * (double)0x7FFE;
+			worst = max(worst, fabs(e));
+			bias += e;
+		}
+		bias /= n;
+		std::cout << "\t *dithered PCM16 worst error " << worst << " LSB, average " << bias << " LSB, " << (worst < 2.0 && fabs(bias) < 0.01 ? "ok" : "BAD") << " !\n";
+		delete pLong;
+	}
+
+	std::cout << "\t *now going to make and drop a new Sfxr for each of 2000 sounds, with and without the sample pool!\n";
+	{
+		double pooledTime = 0.0, heapTime = 0.0;
+		for (int pass = 0; pass < 2; pass++)
+		{
+			Sfxr::setPoolLimit(pass == 0 ? SFXR_POOL_LIMIT : 0);
+			bench.start();
+			for (int i = 0; i < 2000; i++)
+			{
+				Sfxr* pOne = new Sfxr();
+				pOne->create(i % 7);
+				delete pOne;
+			}
+			bench.stop();
+			(pass == 0 ? pooledTime : heapTime) = bench.duration();
+			if (pass == 0) std::cout << "\t *pool holds " << Sfxr::poolBytes() << " bytes after the run !\n";
+		}
+		Sfxr::setPoolLimit(SFXR_POOL_LIMIT);
+		std::cout << "\t *pooled time: " << pooledTime << " seconds, heap time: " << heapTime << " seconds !\n";
+	}
+
 	std::cout << "\n-\nTests complete!\n";
 	delete pSfxr;
 }